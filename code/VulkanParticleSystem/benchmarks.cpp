@@ -0,0 +1,1004 @@
+#include "main.h"
+
+namespace benchmarks {
+
+	using particles::ParticleLayout;
+	using particles::StoragePrecision;
+	using particles::MemoryAccess;
+
+	const float benchmarkDeltaTime = 1 / 60.0f;
+
+	// Position, age and velocity (7 floats) are read and written every step, and lifetime is read.
+	// Brightness is only written on spawn.
+	const uint32_t bytesPerParticleStep = 8 * sizeof(float) + 7 * sizeof(float);
+	const uint32_t halfPrecisionBytesPerParticleStep = (5 * sizeof(float) + 3 * sizeof(uint16_t)) + (4 * sizeof(float) + 3 * sizeof(uint16_t));
+
+	// The analytic mode's step only reads the spawn time, lifetime, and vertical spawn position and velocity.
+	const uint32_t analyticBytesPerParticleStep = 4 * sizeof(float);
+
+	// Starts a simulation with every particle live from the first step, so that throughputs are per particle updated.
+	// The emitter spawns its whole budget at once and its particles never expire, and any that fall below the ground
+	// are replaced in the next step.
+	void initFullSimulation(uint32_t particleCount, ParticleLayout layout, simd::Level level, StoragePrecision precision = StoragePrecision::full) {
+		particles::initSimulation(particleCount, layout, level, precision);
+
+		particles::Emitter emitter = particles::defaultEmitter(particleCount);
+		emitter.rate = particleCount / benchmarkDeltaTime;
+		emitter.lifetime = INFINITY;
+		particles::setEmitter(0, emitter);
+	}
+
+	struct Timing {
+		double duration;
+		particles::UpdateStats totals;
+	};
+
+	Timing timeSteps(int stepCount) {
+		Timing timing = {};
+		double startTime = getTime();
+
+		for (int i = 0; i < stepCount; i++) {
+			auto stats = particles::simulateOnCallingThread(benchmarkDeltaTime);
+			timing.totals.spawnBatches += stats.spawnBatches;
+			timing.totals.spawnedParticles += stats.spawnedParticles;
+			timing.totals.gridBuildTime += stats.gridBuildTime;
+			timing.totals.reorderTime += stats.reorderTime;
+			timing.totals.deferredParticles += stats.deferredParticles;
+		}
+
+		timing.duration = getTime() - startTime;
+		return timing;
+	}
+
+	// As timeSteps(), but on the calling thread and the updater threads.
+	Timing timeStepsOnUpdaterThreads(int stepCount, float deltaTime) {
+		Timing timing = {};
+		double startTime = getTime();
+
+		for (int i = 0; i < stepCount; i++) {
+			auto stats = particles::simulateOnUpdaterThreads(deltaTime);
+			timing.totals.gridBuildTime += stats.gridBuildTime;
+			timing.totals.fluidTime += stats.fluidTime;
+			timing.totals.reorderTime += stats.reorderTime;
+		}
+
+		timing.duration = getTime() - startTime;
+		return timing;
+	}
+
+	void printThroughput(const char *name, const Timing &timing, int stepCount, uint32_t particleCount, uint32_t bytesPerParticle = bytesPerParticleStep) {
+		double msPerStep = timing.duration * 1000 / stepCount;
+		double nsPerParticle = timing.duration * 1e9 / ((double)stepCount * particleCount);
+		double gigabytesPerSecond = (double)bytesPerParticle * particleCount * stepCount / timing.duration / 1e9;
+
+		printf("%-12s %9.3f ms/step %7.3f ns/particle %7.2f GB/s", name, msPerStep, nsPerParticle, gigabytesPerSecond);
+	}
+
+	// The same number of particles divided between emitterCount emitters, each spawning at the default rate for its budget.
+	// Enough steps are run before timing starts for the emitters to reach the steady state where particles die as fast as they spawn.
+	void benchmarkEmitters(uint32_t emitterCount, uint32_t particleCount) {
+		const int warmupSteps = 400;
+		const int timedSteps = 300;
+
+		particles::initSimulation(particleCount, ParticleLayout::soa, simd::detectLevel());
+		particles::removeAllEmitters();
+
+		for (uint32_t e = 0; e < emitterCount; e++) {
+			particles::Emitter emitter = particles::defaultEmitter(particleCount / emitterCount);
+			emitter.position.x += 1.6f * e / emitterCount;
+			particles::addEmitter(emitter);
+		}
+
+		timeSteps(warmupSteps);
+		Timing timing = timeSteps(timedSteps);
+
+		char name[32];
+		snprintf(name, sizeof(name), "%u emitters", emitterCount);
+		printThroughput(name, timing, timedSteps, particles::getLiveParticleCount());
+		printf(" | per step: %6.1f spawn batches, %8.1f spawned\n",
+			timing.totals.spawnBatches / (double)timedSteps,
+			timing.totals.spawnedParticles / (double)timedSteps);
+	}
+
+	// The default emitter with shorter lifetimes, so that fewer of its particles are live at once. Only live particles are
+	// updated, so the time per step should fall with them while the time per live particle stays about the same.
+	void benchmarkLifetime(float lifetime, uint32_t particleCount) {
+		const int warmupSteps = 400;
+		const int timedSteps = 300;
+
+		particles::initSimulation(particleCount, ParticleLayout::soa, simd::detectLevel());
+
+		particles::Emitter emitter = particles::defaultEmitter(particleCount);
+		emitter.lifetime = lifetime;
+		particles::setEmitter(0, emitter);
+
+		timeSteps(warmupSteps);
+		Timing timing = timeSteps(timedSteps);
+
+		uint32_t liveCount = particles::getLiveParticleCount();
+		char name[32];
+		snprintf(name, sizeof(name), "%.1f s", lifetime);
+		printThroughput(name, timing, timedSteps, liveCount);
+		printf(" | %6.2f%% of %u slots live\n", liveCount * 100.0 / particleCount, particleCount);
+	}
+
+	// The default emitter in its steady state with the neighbor grid built after every step. The particles are spread
+	// along the fountain as they are in the application, rather than spawned all at once at the emitter.
+	void benchmarkGrid(uint32_t particleCount) {
+		const int warmupSteps = 400;
+		const int timedSteps = 100;
+
+		particles::enableGrid = true;
+		particles::initSimulation(particleCount, ParticleLayout::soa, simd::detectLevel());
+
+		timeSteps(warmupSteps);
+		Timing timing = timeSteps(timedSteps);
+
+		particles::enableGrid = false;
+
+		uint32_t liveCount = particles::getLiveParticleCount();
+		char name[32];
+		snprintf(name, sizeof(name), "%u live", liveCount);
+		printThroughput(name, timing, timedSteps, liveCount);
+		printf(" | grid build %7.3f ms/step (%4.1f%% of the step)\n",
+			timing.totals.gridBuildTime * 1000 / timedSteps, timing.totals.gridBuildTime * 100 / timing.duration);
+	}
+
+	// The fountain in fluid mode, stepped on threadCount threads. The steps are the application's fixed steps
+	// rather than benchmarkDeltaTime, as the fluid is only stable with steps that short. The warmup runs the emitter
+	// into its steady state, with a pool on the floor, so that the particles have as many neighbors as in the application.
+	void benchmarkFluid(uint32_t particleCount, uint32_t threadCount) {
+		const float stepDuration = 1 / 120.0f;
+		const int warmupSteps = 720;
+		const int timedSteps = 120;
+
+		particles::initSimulation(particleCount, ParticleLayout::soa, simd::detectLevel());
+		particles::setSimulationMode(particles::SimulationMode::fluid);
+		particles::startUpdaterThreads(threadCount);
+
+		timeStepsOnUpdaterThreads(warmupSteps, stepDuration);
+		Timing timing = timeStepsOnUpdaterThreads(timedSteps, stepDuration);
+
+		particles::stopUpdaterThreads();
+		particles::setSimulationMode(particles::SimulationMode::ballistic);
+
+		uint32_t liveCount = particles::getLiveParticleCount();
+		printf("%8u live on %2u threads %9.3f ms/step %8.1f ns/particle | fluid %8.3f ms/step, grid build %7.3f ms/step\n",
+			liveCount, threadCount, timing.duration * 1000 / timedSteps, timing.duration * 1e9 / ((double)timedSteps * liveCount),
+			timing.totals.fluidTime * 1000 / timedSteps, timing.totals.gridBuildTime * 1000 / timedSteps);
+	}
+
+	// benchmarkFluid() with and without work stealing. The pool's crowded cells make some ranges of the fluid far slower
+	// than others, so the slowest thread sets the step time without it. Each step is timed on its own, so that the tail
+	// of the step times shows alongside the mean.
+	void benchmarkScheduling(uint32_t particleCount, uint32_t threadCount, bool workStealing) {
+		const float stepDuration = 1 / 120.0f;
+		const int warmupSteps = 720;
+		const int timedSteps = 240;
+
+		particles::enableWorkStealing = workStealing;
+		particles::initSimulation(particleCount, ParticleLayout::soa, simd::detectLevel());
+		particles::setSimulationMode(particles::SimulationMode::fluid);
+		particles::startUpdaterThreads(threadCount);
+
+		timeStepsOnUpdaterThreads(warmupSteps, stepDuration);
+
+		vector<double> stepTimes;
+		double totalImbalance = 0.0;
+		uint64_t stolenTasks = 0;
+
+		for (int i = 0; i < timedSteps; i++) {
+			double startTime = getTime();
+			auto stats = particles::simulateOnUpdaterThreads(stepDuration);
+			stepTimes.push_back(getTime() - startTime);
+
+			totalImbalance += stats.threadImbalance;
+			stolenTasks += stats.stolenTasks;
+		}
+
+		particles::stopUpdaterThreads();
+		particles::setSimulationMode(particles::SimulationMode::ballistic);
+		particles::enableWorkStealing = true;
+
+		double totalTime = 0.0;
+		for (auto time : stepTimes) totalTime += time;
+		sort(stepTimes.begin(), stepTimes.end());
+
+		printf("%-16s %8.3f ms/step | 99th percentile %8.3f ms, worst %8.3f ms | imbalance %5.3f | %7.1f tasks stolen per step\n",
+			workStealing ? "Work stealing" : "Fixed ranges", totalTime * 1000 / timedSteps, stepTimes[timedSteps * 99 / 100] * 1000,
+			stepTimes.back() * 1000, totalImbalance / timedSteps, stolenTasks / (double)timedSteps);
+	}
+
+	// A memory-bound simulation on threadCount threads, with the state placed on the nodes of the pinned threads that
+	// update it or all of it zeroed on the calling thread's node, with threads free to move. Hardware counters of the
+	// traffic between sockets aren't portable, so it is counted from where the OS says the pages are instead.
+	void benchmarkNumaPlacement(uint32_t particleCount, uint32_t threadCount, bool placement) {
+		const int warmupSteps = 10;
+		const int timedSteps = 60;
+
+		particles::enableNumaPlacement = placement;
+		initFullSimulation(particleCount, ParticleLayout::soa, simd::detectLevel());
+		particles::startUpdaterThreads(threadCount);
+
+		timeStepsOnUpdaterThreads(warmupSteps, benchmarkDeltaTime);
+		Timing timing = timeStepsOnUpdaterThreads(timedSteps, benchmarkDeltaTime);
+		double remoteFraction = particles::findRemoteStateFraction();
+
+		particles::stopUpdaterThreads();
+		particles::enableNumaPlacement = true;
+
+		double remoteMegabytesPerStep = remoteFraction * bytesPerParticleStep * particleCount / (1024 * 1024);
+		printThroughput(placement ? "Placed" : "Unplaced", timing, timedSteps, particleCount);
+		printf(" | %5.1f%% of the state remote, %8.1f MB/step across sockets\n", remoteFraction * 100, remoteMegabytesPerStep);
+	}
+
+	// Steps a small simulation on threadCount threads, so that the passes are short and the time the threads
+	// take to start them shows. With sleepBetweenSteps each step comes a few milliseconds after the last, as they do
+	// between frames, so the threads have stopped spinning and must be woken from the barrier's futex.
+	void benchmarkWakeLatency(uint32_t threadCount, bool sleepBetweenSteps) {
+		const int warmupSteps = 60;
+		const int timedSteps = 300;
+
+		particles::initSimulation(16384, ParticleLayout::soa, simd::detectLevel());
+		particles::startUpdaterThreads(threadCount);
+
+		for (int i = 0; i < warmupSteps; i++) particles::simulateOnUpdaterThreads(benchmarkDeltaTime);
+
+		double stepDuration = 0.0, totalLatency = 0.0, worstLatency = 0.0;
+
+		for (int i = 0; i < timedSteps; i++) {
+			if (sleepBetweenSteps) this_thread::sleep_for(chrono::milliseconds(4));
+
+			double startTime = getTime();
+			auto stats = particles::simulateOnUpdaterThreads(benchmarkDeltaTime);
+			stepDuration += getTime() - startTime;
+
+			totalLatency += stats.meanWakeLatency;
+			if (stats.worstWakeLatency > worstLatency) worstLatency = stats.worstWakeLatency;
+		}
+
+		particles::stopUpdaterThreads();
+
+		printf("%-22s %8.3f ms/step | wake latency %7.2f us mean, %8.2f us worst\n", sleepBetweenSteps ? "Sleeping between steps" : "Back to back",
+			stepDuration * 1000 / timedSteps, totalLatency * 1e6 / timedSteps, worstLatency * 1e6);
+	}
+
+	// benchmarkFluid() with the particles sorted into Morton order every reorderInterval steps, or never with 0. The
+	// sorting's cost is spread over the steps between sorts. Where the particles are in memory is compared by the
+	// cache misses of reading them in the grid's order, in particles::simulateGridCacheMisses()' model of a cache.
+	void benchmarkReordering(uint32_t particleCount, uint32_t reorderInterval, uint32_t threadCount) {
+		const float stepDuration = 1 / 120.0f;
+		const int warmupSteps = 720;
+		const int timedSteps = 120;
+
+		particles::initSimulation(particleCount, ParticleLayout::soa, simd::detectLevel());
+		particles::setSimulationMode(particles::SimulationMode::fluid);
+		particles::reorderInterval = reorderInterval;
+		particles::startUpdaterThreads(threadCount);
+
+		timeStepsOnUpdaterThreads(warmupSteps, stepDuration);
+		Timing timing = timeStepsOnUpdaterThreads(timedSteps, stepDuration);
+		double cacheMisses = particles::simulateGridCacheMisses();
+
+		particles::stopUpdaterThreads();
+		particles::reorderInterval = 0;
+		particles::setSimulationMode(particles::SimulationMode::ballistic);
+
+		char name[32];
+		if (reorderInterval > 0) snprintf(name, sizeof(name), "Every %u steps", reorderInterval);
+		else snprintf(name, sizeof(name), "Never");
+
+		printf("%-16s %9.3f ms/step | fluid %8.3f, grid build %7.3f, reordering %7.3f ms/step | %5.2f cache misses per particle\n",
+			name, timing.duration * 1000 / timedSteps, timing.totals.fluidTime * 1000 / timedSteps,
+			timing.totals.gridBuildTime * 1000 / timedSteps, timing.totals.reorderTime * 1000 / timedSteps, cacheMisses);
+	}
+
+	// Enough steps to process roughly 50 million particles, so small counts aren't dominated by timer noise.
+	int throughputStepCount(uint32_t particleCount) {
+		int stepCount = (int)(50000000 / particleCount);
+		return stepCount < 5 ? 5 : stepCount;
+	}
+
+	// The compiled-in Forces list against every force type fused into the same pass. Every force is given a non-zero
+	// setting, so that the extra forces can't be skipped, and the settings are restored afterwards.
+	void benchmarkForces(const char *name, bool allForces, uint32_t particleCount) {
+		const int warmupSteps = 2;
+		const int timedSteps = throughputStepCount(particleCount);
+
+		particles::ForceSettings savedSettings = particles::forceSettings;
+		particles::ForceSettings &settings = particles::forceSettings;
+		settings.quadraticDrag = 0.05f;
+		settings.attractors[0] = { vec3(0.3f, 0.2f, 0.9f), 0.2f, 0.1f };
+		settings.attractors[1] = { vec3(-0.3f, 0.4f, 1.1f), 0.1f, 0.1f };
+		settings.vortex = { vec3(0, 0, 1), vec3(0, 1, 0), 0.3f, 0.1f };
+		settings.wind = { vec3(0.2f, 0, 0), 0.5f };
+		particles::simulateAllForces = allForces;
+
+		initFullSimulation(particleCount, ParticleLayout::soa, simd::detectLevel());
+
+		timeSteps(warmupSteps);
+		Timing timing = timeSteps(timedSteps);
+
+		particles::simulateAllForces = false;
+		particles::forceSettings = savedSettings;
+
+		printThroughput(name, timing, timedSteps, particleCount);
+		printf("\n");
+	}
+
+	// The application's kernel with and without its Colliders list. The colliders are tested against every particle
+	// without branches, so the cost doesn't depend on how many particles hit them.
+	void benchmarkColliders(const char *name, bool colliders, uint32_t particleCount) {
+		const int warmupSteps = 2;
+		const int timedSteps = throughputStepCount(particleCount);
+
+		particles::simulateColliders = colliders;
+		initFullSimulation(particleCount, ParticleLayout::soa, simd::detectLevel());
+
+		timeSteps(warmupSteps);
+		Timing timing = timeSteps(timedSteps);
+
+		particles::simulateColliders = true;
+
+		printThroughput(name, timing, timedSteps, particleCount);
+		printf("\n");
+	}
+
+	// The application's forces with each number of turbulence octaves. Zero octaves is the cost of the other forces and
+	// the memory traffic, so the difference from one octave to the next is the cost of an octave.
+	void benchmarkTurbulenceOctaves(simd::Level level, uint32_t particleCount) {
+		const int warmupSteps = 2;
+		const int timedSteps = throughputStepCount(particleCount);
+
+		particles::Turbulence savedTurbulence = particles::forceSettings.turbulence;
+		double previousNsPerParticle = 0;
+
+		for (uint32_t octaves = 0; octaves <= 4; octaves++) {
+			particles::forceSettings.turbulence.octaves = octaves;
+			initFullSimulation(particleCount, ParticleLayout::soa, level);
+
+			timeSteps(warmupSteps);
+			Timing timing = timeSteps(timedSteps);
+
+			double nsPerParticle = timing.duration * 1e9 / ((double)timedSteps * particleCount);
+			char name[32];
+			snprintf(name, sizeof(name), "%u octaves", octaves);
+			printThroughput(name, timing, timedSteps, particleCount);
+			if (octaves > 0) printf(" | %+.3f ns/particle for this octave\n", nsPerParticle - previousNsPerParticle);
+			else printf("\n");
+
+			previousNsPerParticle = nsPerParticle;
+		}
+
+		particles::forceSettings.turbulence = savedTurbulence;
+	}
+
+	void benchmarkLayout(const char *name, ParticleLayout layout, uint32_t particleCount) {
+		const int warmupSteps = 2;
+		const int timedSteps = throughputStepCount(particleCount);
+
+		initFullSimulation(particleCount, layout, simd::detectLevel());
+
+		timeSteps(warmupSteps);
+		Timing timing = timeSteps(timedSteps);
+
+		printThroughput(name, timing, timedSteps, particleCount);
+		printf(" (%s)\n", simd::levelName(particles::simdLevel));
+	}
+
+	void benchmarkSimdLevel(simd::Level level, uint32_t particleCount) {
+		const int warmupSteps = 2;
+		const int timedSteps = throughputStepCount(particleCount);
+
+		initFullSimulation(particleCount, ParticleLayout::soa, level);
+
+		timeSteps(warmupSteps);
+		Timing timing = timeSteps(timedSteps);
+
+		printThroughput(simd::levelName(level), timing, timedSteps, particleCount);
+		printf("\n");
+	}
+
+	void benchmarkPrecision(const char *name, StoragePrecision precision, uint32_t particleCount) {
+		const int warmupSteps = 2;
+		const int timedSteps = throughputStepCount(particleCount);
+
+		initFullSimulation(particleCount, ParticleLayout::soa, simd::detectLevel(), precision);
+
+		timeSteps(warmupSteps);
+		Timing timing = timeSteps(timedSteps);
+
+		uint32_t bytesPerParticle = precision == StoragePrecision::half ? halfPrecisionBytesPerParticleStep : bytesPerParticleStep;
+		printThroughput(name, timing, timedSteps, particleCount, bytesPerParticle);
+		printf("\n");
+	}
+
+	// Runs the same simulation in both precisions and compares the positions of the live particles at several points.
+	// Particles are spawned at the same times with the same velocities in both, so the differences come from rounding
+	// the velocities as they are stored. Particles that drift far apart are counted separately as diverged, and the
+	// distance between the centroids of the two simulations shows whether the system as a whole still behaves the same.
+	// The lifetime is shorter than the particles take to reach the ground, so they die at the same time in both
+	// precisions and stay in the same slots.
+	void initDriftSimulation(uint32_t particleCount, StoragePrecision precision) {
+		const float lifetime = 4.0f;
+
+		particles::initSimulation(particleCount, ParticleLayout::soa, simd::detectLevel(), precision);
+
+		particles::Emitter emitter = particles::defaultEmitter(particleCount);
+		emitter.rate = particleCount / lifetime;
+		emitter.lifetime = lifetime;
+		particles::setEmitter(0, emitter);
+	}
+
+	void reportPrecisionDrift() {
+		const uint32_t particleCount = 65536;
+		const int checkpointSteps[] = { 60, 600, 6000 };
+		const int checkpointCount = sizeof(checkpointSteps) / sizeof(checkpointSteps[0]);
+		const float divergedDistance = 0.1f;
+
+		printf("\nHalf precision drift against full precision, %u particles\n", particleCount);
+
+		vector<vec3> fullPositions[checkpointCount];
+		vector<bool> fullLive[checkpointCount];
+		initDriftSimulation(particleCount, StoragePrecision::full);
+
+		for (int c = 0, step = 0; c < checkpointCount; c++) {
+			for (; step < checkpointSteps[c]; step++) particles::simulateOnCallingThread(benchmarkDeltaTime);
+			for (uint32_t i = 0; i < particleCount; i++) {
+				fullPositions[c].push_back(particles::getParticlePosition(i));
+				fullLive[c].push_back(particles::isParticleLive(i));
+			}
+		}
+
+		initDriftSimulation(particleCount, StoragePrecision::half);
+
+		for (int c = 0, step = 0; c < checkpointCount; c++) {
+			for (; step < checkpointSteps[c]; step++) particles::simulateOnCallingThread(benchmarkDeltaTime);
+
+			double errorSum = 0;
+			float maxError = 0;
+			uint32_t comparedCount = 0;
+			uint32_t divergedCount = 0;
+			vec3 differenceSum = vec3(0);
+
+			// A particle live in only one of the simulations has died at a different time, so counts as diverged.
+			for (uint32_t i = 0; i < particleCount; i++) {
+				bool live = particles::isParticleLive(i);
+				if (!live && !fullLive[c][i]) continue;
+
+				comparedCount++;
+
+				if (live != fullLive[c][i]) {
+					divergedCount++;
+					continue;
+				}
+
+				vec3 difference = particles::getParticlePosition(i) - fullPositions[c][i];
+				differenceSum += difference;
+
+				float error = sqrtf(difference.x * difference.x + difference.y * difference.y + difference.z * difference.z);
+
+				if (error > divergedDistance) divergedCount++;
+				else {
+					errorSum += error;
+					if (error > maxError) maxError = error;
+				}
+			}
+
+			uint32_t closeCount = comparedCount - divergedCount;
+			vec3 centroidDifference = comparedCount ? differenceSum / (float)comparedCount : vec3(0);
+			float centroidDistance = sqrtf(centroidDifference.x * centroidDifference.x + centroidDifference.y * centroidDifference.y + centroidDifference.z * centroidDifference.z);
+			printf("after %5i steps: mean position error %.2e, max %.2e, %5.2f%% of particles diverged, centroids %.2e apart\n",
+				checkpointSteps[c], closeCount ? errorSum / closeCount : 0.0, maxError, comparedCount ? divergedCount * 100.0 / comparedCount : 0.0, centroidDistance);
+		}
+	}
+
+	const char *integratorName(particles::Integrator integrator) {
+		switch (integrator) {
+		case particles::Integrator::velocityVerlet: return "Verlet";
+		case particles::Integrator::midpoint: return "RK2";
+		default: return "Euler";
+		}
+	}
+
+	const particles::Integrator integrators[] = { particles::Integrator::semiImplicitEuler, particles::Integrator::velocityVerlet, particles::Integrator::midpoint };
+
+	void benchmarkIntegrator(particles::Integrator integrator, uint32_t particleCount) {
+		const int warmupSteps = 2;
+		const int timedSteps = throughputStepCount(particleCount);
+
+		initFullSimulation(particleCount, ParticleLayout::soa, simd::detectLevel());
+		particles::setIntegrator(integrator);
+
+		timeSteps(warmupSteps);
+		Timing timing = timeSteps(timedSteps);
+
+		particles::setIntegrator(particles::Integrator::semiImplicitEuler);
+
+		printThroughput(integratorName(integrator), timing, timedSteps, particleCount);
+		printf("\n");
+	}
+
+	// Runs the application's forces for the same simulated time with each integrator at several step sizes, and
+	// compares the positions with a reference run by RK2 at a sixteenth of the smallest step. The whole budget spawns
+	// at the end of the first step whatever its size, with the same velocities, and nothing spawns after it, so the
+	// runs differ only in how they integrate. The turbulence is held still, as the forces are evaluated at the time of
+	// the step rather than at the integrators' intermediate times, and the colliders are moved out of the way, as a
+	// bounce at a slightly different time would swamp the integration error. Particles that die at a different time in the two runs are counted as diverged.
+	void runIntegratorAccuracy(uint32_t particleCount, particles::Integrator integrator, float deltaTime, int stepCount, vector<vec3> &positions, vector<bool> &live) {
+		particles::initSimulation(particleCount, ParticleLayout::soa, simd::detectLevel());
+		particles::setIntegrator(integrator);
+
+		particles::Emitter emitter = particles::defaultEmitter(particleCount);
+		emitter.rate = 2 * particleCount / deltaTime;
+		emitter.lifetime = INFINITY;
+		particles::setEmitter(0, emitter);
+		particles::simulateOnCallingThread(deltaTime);
+
+		emitter.rate = 0;
+		particles::setEmitter(0, emitter);
+		for (int i = 0; i < stepCount; i++) particles::simulateOnCallingThread(deltaTime);
+
+		positions.resize(particleCount);
+		live.resize(particleCount);
+
+		for (uint32_t i = 0; i < particleCount; i++) {
+			positions[i] = particles::getParticlePosition(i);
+			live[i] = particles::isParticleLive(i);
+		}
+
+		particles::setIntegrator(particles::Integrator::semiImplicitEuler);
+	}
+
+	void reportIntegratorAccuracy() {
+		const uint32_t particleCount = 65536;
+		const float duration = 1.5f;
+		const float deltaTimes[] = { 1 / 240.0f, 1 / 120.0f, 1 / 60.0f, 1 / 30.0f };
+		const int referenceSubsteps = 16;
+		const float divergedDistance = 0.1f;
+
+		printf("\nIntegrator accuracy after %.1f s against RK2 at 1/%.0f s steps, %u particles\n", duration, referenceSubsteps / deltaTimes[0], particleCount);
+
+		particles::ColliderSettings savedColliders = particles::colliderSettings;
+		particles::colliderSettings = {};
+		vec3 savedDrift = particles::forceSettings.turbulence.drift;
+		particles::forceSettings.turbulence.drift = vec3(0);
+
+		vector<vec3> referencePositions, positions;
+		vector<bool> referenceLive, live;
+		runIntegratorAccuracy(particleCount, particles::Integrator::midpoint, deltaTimes[0] / referenceSubsteps,
+			(int)roundf(duration / deltaTimes[0]) * referenceSubsteps, referencePositions, referenceLive);
+
+		for (auto integrator : integrators) {
+			for (auto deltaTime : deltaTimes) {
+				runIntegratorAccuracy(particleCount, integrator, deltaTime, (int)roundf(duration / deltaTime), positions, live);
+
+				double errorSum = 0;
+				float maxError = 0;
+				uint32_t comparedCount = 0;
+				uint32_t divergedCount = 0;
+
+				for (uint32_t i = 0; i < particleCount; i++) {
+					if (!live[i] && !referenceLive[i]) continue;
+
+					comparedCount++;
+
+					if (live[i] != referenceLive[i]) {
+						divergedCount++;
+						continue;
+					}
+
+					float error = length(positions[i] - referencePositions[i]);
+
+					if (error > divergedDistance) divergedCount++;
+					else {
+						errorSum += error;
+						if (error > maxError) maxError = error;
+					}
+				}
+
+				uint32_t closeCount = comparedCount - divergedCount;
+				printf("%-6s 1/%-3.0f s steps: mean position error %.2e, max %.2e, %5.2f%% of particles diverged\n", integratorName(integrator), 1 / deltaTime,
+					closeCount ? errorSum / closeCount : 0.0, maxError, comparedCount ? divergedCount * 100.0 / comparedCount : 0.0);
+			}
+		}
+
+		particles::colliderSettings = savedColliders;
+		particles::forceSettings.turbulence.drift = savedDrift;
+	}
+
+	// The ballistic kernel with only gravity and linear drag against the analytic mode, which follows the same paths
+	// without storing them. The positions are also gathered for rendering after each step, as that is where the analytic
+	// mode evaluates them.
+	void benchmarkAnalytic(const char *name, particles::SimulationMode mode, uint32_t particleCount) {
+		const int warmupSteps = 2;
+		const int timedSteps = throughputStepCount(particleCount);
+
+		particles::Turbulence savedTurbulence = particles::forceSettings.turbulence;
+		particles::forceSettings.turbulence.octaves = 0;
+		particles::simulateColliders = false;
+
+		initFullSimulation(particleCount, ParticleLayout::soa, simd::detectLevel());
+		particles::setSimulationMode(mode);
+
+		timeSteps(warmupSteps);
+		Timing timing = timeSteps(timedSteps);
+
+		double renderStartTime = getTime();
+		for (int i = 0; i < timedSteps; i++) particles::prepareRenderableParticles();
+		double renderDuration = getTime() - renderStartTime;
+
+		particles::setSimulationMode(particles::SimulationMode::ballistic);
+		particles::simulateColliders = true;
+		particles::forceSettings.turbulence = savedTurbulence;
+
+		bool analytic = mode == particles::SimulationMode::analytic;
+		printThroughput(name, timing, timedSteps, particleCount, analytic ? analyticBytesPerParticleStep : bytesPerParticleStep);
+		printf(" | positions for rendering %7.3f ns/particle\n", renderDuration * 1e9 / ((double)timedSteps * particleCount));
+	}
+
+	// The default fountain in the steady state, stepped in ballistic mode and evaluated in procedural mode. Procedural
+	// mode's steps do nothing and procedural.vert evaluates its particles, so the CPU's share of a frame is its step
+	// alone. Its CPU evaluation, for evaluateProceduralOnCpu, is timed to show what the shader takes over, along with
+	// the upload of the positions that it saves.
+	void benchmarkProcedural(particles::SimulationMode mode, uint32_t particleCount) {
+		const int warmupSteps = 400;
+		const int timedSteps = 100;
+
+		particles::initSimulation(particleCount, ParticleLayout::soa, simd::detectLevel());
+		particles::setSimulationMode(mode);
+
+		timeSteps(warmupSteps);
+		Timing timing = timeSteps(timedSteps);
+
+		uint32_t liveCount = 0;
+		double renderStartTime = getTime();
+		for (int i = 0; i < timedSteps; i++) liveCount = particles::prepareRenderableParticles();
+		double renderDuration = getTime() - renderStartTime;
+
+		particles::setSimulationMode(particles::SimulationMode::ballistic);
+
+		bool procedural = mode == particles::SimulationMode::procedural;
+		printf("%-12s %9.4f ms/step | %u live, %s %7.3f ms/frame, %.1f MB/frame to upload\n",
+			procedural ? "Procedural" : "Ballistic", timing.duration * 1000 / timedSteps, liveCount,
+			procedural ? "evaluated on the CPU" : "gathered for rendering", renderDuration * 1000 / timedSteps,
+			liveCount * 4 * sizeof(float) / 1e6);
+	}
+
+	// The default fountain in its steady state with the update-rate LOD at lod, or adapting it to keep each step within
+	// budget seconds if budget is nonzero. Gathering the particles for rendering is timed too, as it extrapolates those
+	// whose updates were deferred. Returns the seconds per step.
+	double benchmarkUpdateRateLod(float lod, float budget, uint32_t particleCount) {
+		const int warmupSteps = 400;
+		const int timedSteps = 300;
+
+		particles::initSimulation(particleCount, ParticleLayout::soa, simd::detectLevel());
+		particles::updateRateLod = lod;
+		particles::lodStepBudget = budget;
+
+		timeSteps(warmupSteps);
+		Timing timing = timeSteps(timedSteps);
+		uint32_t liveCount = particles::getLiveParticleCount();
+		float finalLod = particles::updateRateLod;
+
+		double renderStartTime = getTime();
+		for (int i = 0; i < timedSteps; i++) particles::prepareRenderableParticles();
+		double renderDuration = getTime() - renderStartTime;
+
+		particles::updateRateLod = 0.0f;
+		particles::lodStepBudget = 0.0f;
+
+		char name[32];
+		if (budget > 0.0f) snprintf(name, sizeof(name), "%.2f ms budget", budget * 1000);
+		else snprintf(name, sizeof(name), "LOD %.2f", lod);
+
+		printf("%-16s %9.3f ms/step | LOD %.2f, %5.1f%% of %u live deferred, gathered for rendering %7.3f ms/frame\n",
+			name, timing.duration * 1000 / timedSteps, finalLod, timing.totals.deferredParticles * 100.0 / ((double)timedSteps * liveCount),
+			liveCount, renderDuration * 1000 / timedSteps);
+
+		return timing.duration / timedSteps;
+	}
+
+	const char *memoryAccessName(MemoryAccess access) {
+		switch (access) {
+		case MemoryAccess::automatic: return "automatic";
+		case MemoryAccess::prefetched: return "prefetched";
+		default: return "cached";
+		}
+	}
+
+	struct MemoryBandwidth {
+		double copyGigabytesPerSecond;
+		double inPlaceGigabytesPerSecond;
+	};
+
+	// The best bandwidths achieved on buffers too large for any cache, counting both the bytes read and the bytes written.
+	// Copying uses memcpy() between two buffers. In place, every vector of one buffer is read, modified and written back,
+	// which is the access pattern of updateRange().
+	MemoryBandwidth measureMemoryBandwidth() {
+		uint64_t bufferBytes = 2 * simd::lastLevelCacheBytes();
+		if (bufferBytes < 256 * 1024 * 1024) bufferBytes = 256 * 1024 * 1024;
+		if (bufferBytes > 1024 * 1024 * 1024) bufferBytes = 1024 * 1024 * 1024;
+
+		vector<uint8_t> source(bufferBytes, 1);
+		vector<uint8_t> destination(bufferBytes, 0);
+
+		double bestCopyDuration = 1e30;
+		double bestInPlaceDuration = 1e30;
+
+		for (int i = 0; i < 4; i++) {
+			double startTime = getTime();
+			memcpy(destination.data(), source.data(), bufferBytes);
+			double duration = getTime() - startTime;
+			if (duration < bestCopyDuration) bestCopyDuration = duration;
+
+			__m128i *vectors = (__m128i*)destination.data();
+			const __m128i one = _mm_set1_epi32(1);
+			startTime = getTime();
+			for (size_t v = 0; v < bufferBytes / sizeof(__m128i); v++) _mm_store_si128(vectors + v, _mm_add_epi32(_mm_load_si128(vectors + v), one));
+			duration = getTime() - startTime;
+			if (duration < bestInPlaceDuration) bestInPlaceDuration = duration;
+		}
+
+		MemoryBandwidth bandwidth;
+		bandwidth.copyGigabytesPerSecond = 2.0 * bufferBytes / bestCopyDuration / 1e9;
+		bandwidth.inPlaceGigabytesPerSecond = 2.0 * bufferBytes / bestInPlaceDuration / 1e9;
+		return bandwidth;
+	}
+
+	Timing timeMemoryAccess(MemoryAccess access, uint32_t particleCount, int timedSteps) {
+		particles::requestedMemoryAccess = access;
+		initFullSimulation(particleCount, ParticleLayout::soa, simd::detectLevel());
+
+		timeSteps(2);
+		Timing timing = timeSteps(timedSteps);
+
+		particles::requestedMemoryAccess = MemoryAccess::automatic;
+		return timing;
+	}
+
+	// Sweeps the prefetch distance at a count far beyond the last level cache, and keeps the fastest for the benchmarks that follow.
+	void tunePrefetchDistance(uint32_t particleCount) {
+		const uint32_t distances[] = { 256, 512, 1024, 2048, 4096, 8192 };
+		const int timedSteps = throughputStepCount(particleCount);
+
+		printf("\nPrefetch distance sweep, %u particles on one thread\n", particleCount);
+
+		double bestDuration = 1e30;
+		uint32_t bestDistance = particles::prefetchDistance;
+
+		for (auto distance : distances) {
+			particles::prefetchDistance = distance;
+			Timing timing = timeMemoryAccess(MemoryAccess::prefetched, particleCount, timedSteps);
+
+			char name[32];
+			snprintf(name, sizeof(name), "%u ahead", distance);
+			printThroughput(name, timing, timedSteps, particleCount);
+			printf("\n");
+
+			if (timing.duration < bestDuration) {
+				bestDuration = timing.duration;
+				bestDistance = distance;
+			}
+		}
+
+		particles::prefetchDistance = bestDistance;
+		printf("Using a prefetch distance of %u particles\n", bestDistance);
+	}
+
+	void benchmarkMemoryAccess(MemoryBandwidth machineBandwidth) {
+		const uint32_t particleCounts[] = { 10000, 30000, 100000, 300000, 1000000, 3000000, 10000000, 30000000, 50000000 };
+		const MemoryAccess accesses[] = { MemoryAccess::cached, MemoryAccess::prefetched };
+
+		for (auto particleCount : particleCounts) {
+			double workingSetMegabytes = 8.0 * sizeof(float) * particleCount / (1024 * 1024);
+			printf("\nMemory access benchmark, %u particles on one thread (%.1f MB of attributes updated every step)\n", particleCount, workingSetMegabytes);
+
+			const int timedSteps = throughputStepCount(particleCount);
+
+			for (auto access : accesses) {
+				Timing timing = timeMemoryAccess(access, particleCount, timedSteps);
+				printThroughput(memoryAccessName(access), timing, timedSteps, particleCount);
+
+				double gigabytesPerSecond = (double)bytesPerParticleStep * particleCount * timedSteps / timing.duration / 1e9;
+				printf(" (%3.0f%% of in-place bandwidth)\n", gigabytesPerSecond * 100 / machineBandwidth.inPlaceGigabytesPerSecond);
+			}
+
+			// Laying out the emitters again reselects the memory access without reinitialising.
+			particles::removeAllEmitters();
+			particles::addEmitter(particles::defaultEmitter(particleCount));
+			printf("automatic chooses %s\n", memoryAccessName(particles::memoryAccess));
+		}
+	}
+
+	// Runs the same simulation divided into different numbers of ranges, as it would be divided between that many
+	// updater threads, and compares the final states. The particle count leaves a partial vector at the end. With lod,
+	// the first run adapts the update-rate LOD to a budget a little under its steps' duration without it, and the others
+	// replay its changes. The colliders, which cap the LOD's intervals, are left out so that every tier shows.
+	void checkDeterminism(bool lod) {
+		const uint32_t particleCount = 100003;
+		const int stepCount = 600;
+		const uint32_t rangeCounts[] = { 1, 2, 3, 7, 16, 61 };
+
+		printf("\nDeterminism check%s, %u particles for %i steps\n", lod ? " with the update-rate LOD" : "", particleCount, stepCount);
+
+		if (lod) {
+			particles::simulateColliders = false;
+			particles::initSimulation(particleCount, ParticleLayout::soa, simd::detectLevel());
+			Timing timing = timeSteps(stepCount);
+			particles::lodStepBudget = (float)(timing.duration / stepCount * 0.85);
+		}
+
+		uint64_t firstChecksum = 0;
+		bool allIdentical = true;
+
+		for (auto rangeCount : rangeCounts) {
+			particles::initSimulation(particleCount, ParticleLayout::soa, simd::detectLevel());
+			for (int i = 0; i < stepCount; i++) particles::simulateOnCallingThread(benchmarkDeltaTime, rangeCount);
+
+			// The runs after the first replay the changes it made to the LOD
+			particles::replayUpdateRateLod = lod;
+
+			uint64_t checksum = particles::stateChecksum();
+			if (rangeCount == rangeCounts[0]) firstChecksum = checksum;
+			allIdentical = allIdentical && checksum == firstChecksum;
+
+			printf("%3u ranges: state checksum %016llx\n", rangeCount, (unsigned long long)checksum);
+		}
+
+		if (lod) printf("%zu changes to the LOD replayed, ending at %.2f\n", particles::updateRateLodChanges.size(), particles::updateRateLod);
+		printf(allIdentical ? "All identical\n" : "MISMATCH: the result depends on the number of threads\n");
+
+		particles::replayUpdateRateLod = false;
+		particles::lodStepBudget = 0.0f;
+		particles::updateRateLod = 0.0f;
+		particles::simulateColliders = true;
+	}
+
+	void run() {
+		simd::Level detectedLevel = simd::detectLevel();
+		printf("\nDetected instruction set: %s\n", simd::levelName(detectedLevel));
+
+		// Everything but the grid benchmark measures the update alone
+		particles::enableGrid = false;
+
+		checkDeterminism(false);
+		checkDeterminism(true);
+
+		// Every kernel the CPU can run, at an L2-resident count and an LLC/DRAM-resident count
+		const uint32_t simdParticleCounts[] = { 65536, 4194304 };
+
+		for (auto particleCount : simdParticleCounts) {
+			printf("\nInstruction set benchmark, %u particles on one thread\n", particleCount);
+
+			for (int level = (int)simd::Level::scalar; level <= (int)detectedLevel; level++) {
+				benchmarkSimdLevel((simd::Level)level, particleCount);
+			}
+		}
+
+		printf("\nEmitter benchmark, 500000 particles on one thread\n");
+		const uint32_t emitterCounts[] = { 1, 8, 64 };
+		for (auto emitterCount : emitterCounts) benchmarkEmitters(emitterCount, 500000);
+
+		printf("\nLifetime benchmark, 500000 particles on one thread\n");
+		const float lifetimes[] = { 6.0f, 3.0f, 1.5f, 0.5f };
+		for (auto lifetime : lifetimes) benchmarkLifetime(lifetime, 500000);
+
+		const uint32_t gridParticleCounts[] = { 65536, 524288, 4194304 };
+		printf("\nNeighbor grid benchmark, on one thread\n");
+		for (auto particleCount : gridParticleCounts) benchmarkGrid(particleCount);
+
+		// The fluid's neighbor search is bound by arithmetic rather than memory, so it is run on every core, and then at
+		// one count on fewer cores to show how it scales.
+		uint32_t hardwareThreads = thread::hardware_concurrency();
+		if (hardwareThreads == 0) hardwareThreads = 1;
+
+		const uint32_t fluidParticleCounts[] = { 65536, 131072, 262144, 524288 };
+		printf("\nSPH fluid benchmark, on %u threads\n", hardwareThreads);
+		for (auto particleCount : fluidParticleCounts) benchmarkFluid(particleCount, hardwareThreads);
+
+		printf("\nSPH fluid scaling, 262144 particles\n");
+		for (uint32_t threadCount = 1; threadCount < hardwareThreads; threadCount *= 2) benchmarkFluid(262144, threadCount);
+
+		printf("\nUpdater thread scheduling, 262144 particles of fluid on %u threads\n", hardwareThreads);
+		const bool workStealingSettings[] = { false, true };
+		for (auto workStealing : workStealingSettings) benchmarkScheduling(262144, hardwareThreads, workStealing);
+
+		printf("\nNUMA placement, 16777216 particles on %u threads over %u nodes\n", hardwareThreads, particles::getNumaNodeCount());
+		const bool placementSettings[] = { false, true };
+		for (auto placement : placementSettings) benchmarkNumaPlacement(16777216, hardwareThreads, placement);
+
+		printf("\nUpdater thread wake latency, 16384 particles on %u threads\n", hardwareThreads);
+		const bool sleepsBetweenSteps[] = { false, true };
+		for (auto sleepBetweenSteps : sleepsBetweenSteps) benchmarkWakeLatency(hardwareThreads, sleepBetweenSteps);
+
+		printf("\nMorton reordering, 262144 particles of fluid on %u threads\n", hardwareThreads);
+		const uint32_t reorderIntervals[] = { 0, 60, 15 };
+		for (auto reorderInterval : reorderIntervals) benchmarkReordering(262144, reorderInterval, hardwareThreads);
+
+		const uint32_t colliderParticleCounts[] = { 65536, 4194304 };
+
+		for (auto particleCount : colliderParticleCounts) {
+			printf("\nCollider benchmark, %u particles on one thread\n", particleCount);
+			benchmarkColliders("None", false, particleCount);
+			benchmarkColliders("Colliders", true, particleCount);
+		}
+
+		// The noise is the most arithmetic-heavy part of the step, so the vectorised kernel is compared with the scalar one
+		const simd::Level turbulenceLevels[] = { simd::Level::scalar, detectedLevel };
+
+		for (auto level : turbulenceLevels) {
+			printf("\nTurbulence benchmark, 500000 particles on one thread (%s)\n", simd::levelName(level));
+			benchmarkTurbulenceOctaves(level, 500000);
+		}
+
+		// The extra forces are arithmetic on values already loaded, so they should cost little more once the step is memory bound
+		const uint32_t forceParticleCounts[] = { 65536, 4194304 };
+
+		for (auto particleCount : forceParticleCounts) {
+			printf("\nForce pipeline benchmark, %u particles on one thread\n", particleCount);
+			benchmarkForces("Forces", false, particleCount);
+			benchmarkForces("AllForces", true, particleCount);
+		}
+
+		// Verlet and RK2 evaluate the forces twice, which costs most where the turbulence makes the step arithmetic bound
+		const uint32_t integratorParticleCounts[] = { 65536, 4194304 };
+
+		for (auto particleCount : integratorParticleCounts) {
+			printf("\nIntegrator benchmark, %u particles on one thread\n", particleCount);
+			for (auto integrator : integrators) benchmarkIntegrator(integrator, particleCount);
+		}
+
+		reportIntegratorAccuracy();
+
+		const uint32_t analyticParticleCounts[] = { 65536, 4194304 };
+
+		for (auto particleCount : analyticParticleCounts) {
+			printf("\nAnalytic mode benchmark, %u particles on one thread\n", particleCount);
+			benchmarkAnalytic("Ballistic", particles::SimulationMode::ballistic, particleCount);
+			benchmarkAnalytic("Analytic", particles::SimulationMode::analytic, particleCount);
+		}
+
+		printf("\nProcedural mode benchmark, 500000 particles on one thread\n");
+		benchmarkProcedural(particles::SimulationMode::ballistic, 500000);
+		benchmarkProcedural(particles::SimulationMode::procedural, 500000);
+
+		// The adaptive run is given half of the full rate's step time
+		printf("\nUpdate-rate LOD benchmark, 1000000 particles on one thread\n");
+		double fullRateStepTime = benchmarkUpdateRateLod(0.0f, 0.0f, 1000000);
+		const float lods[] = { 0.25f, 0.5f, 1.0f };
+		for (auto lod : lods) benchmarkUpdateRateLod(lod, 0.0f, 1000000);
+		benchmarkUpdateRateLod(0.0f, (float)(fullRateStepTime / 2), 1000000);
+
+		const uint32_t precisionParticleCounts[] = { 65536, 4194304, 16777216 };
+
+		for (auto particleCount : precisionParticleCounts) {
+			printf("\nStorage precision benchmark, %u particles on one thread\n", particleCount);
+			benchmarkPrecision("full", StoragePrecision::full, particleCount);
+			benchmarkPrecision("half", StoragePrecision::half, particleCount);
+		}
+
+		reportPrecisionDrift();
+
+		uint64_t lastLevelCacheBytes = simd::lastLevelCacheBytes();
+		MemoryBandwidth machineBandwidth = measureMemoryBandwidth();
+		printf("\nLast level cache: %.1f MB\nMemory bandwidth (bytes read + bytes written): %.2f GB/s copying, %.2f GB/s in place\n",
+			lastLevelCacheBytes / (1024.0 * 1024.0), machineBandwidth.copyGigabytesPerSecond, machineBandwidth.inPlaceGigabytesPerSecond);
+
+		// Tune where the particles are at least twice the size of the last level cache
+		uint64_t tuningParticleCount = 2 * lastLevelCacheBytes / (sizeof(float) * 7);
+		tunePrefetchDistance(tuningParticleCount > 16777216 ? (uint32_t)tuningParticleCount : 16777216);
+		benchmarkMemoryAccess(machineBandwidth);
+
+		// From comfortably inside L2 to far beyond any LLC
+		const uint32_t layoutParticleCounts[] = { 16384, 65536, 524288, 4194304, 16777216 };
+
+		for (auto particleCount : layoutParticleCounts) {
+			double workingSetMegabytes = (double)bytesPerParticleStep / 2 * particleCount / (1024 * 1024);
+			printf("\nLayout benchmark, %u particles on one thread (%.1f MB of positions and velocities)\n", particleCount, workingSetMegabytes);
+			benchmarkLayout("SoA", ParticleLayout::soa, particleCount);
+			benchmarkLayout("AoSoA-8", ParticleLayout::aosoa8, particleCount);
+			benchmarkLayout("AoSoA-16", ParticleLayout::aosoa16, particleCount);
+		}
+	}
+}
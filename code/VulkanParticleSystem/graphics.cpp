@@ -29,6 +29,7 @@ namespace graphics {
 	VkQueue queue = VK_NULL_HANDLE;
 	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
 	VkPipeline pipeline = VK_NULL_HANDLE;
+	VkPipeline proceduralPipeline = VK_NULL_HANDLE;
 	VkRenderPass renderPass = VK_NULL_HANDLE;
 	vector<VkFramebuffer> framebuffers;
 	VkSwapchainKHR swapchain = VK_NULL_HANDLE;
@@ -308,13 +309,14 @@ namespace graphics {
 		return 0;
 	}
 
+	// The buffers are left mapped for their whole lifetime so that each frame only costs a memcpy.
 	void buildVertexBuffers(
-		uint32_t particleCount, uint8_t componentCount, float *componentPtrs[],
-		vector<VkBuffer> *vertexBuffers, vector<VkDeviceMemory> *vertexBufferMemSlots) {
+		uint32_t particleCapacity, uint8_t componentCount,
+		vector<VkBuffer> *vertexBuffers, vector<VkDeviceMemory> *vertexBufferMemSlots, vector<float*> *mappedVertexBuffers) {
 
 		VkBufferCreateInfo bufferInfo = {};
 		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		bufferInfo.size = sizeof(float) * particleCount;
+		bufferInfo.size = sizeof(float) * particleCapacity;
 		bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
 		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
@@ -338,21 +340,35 @@ namespace graphics {
 			result = vkBindBufferMemory(device, vertexBuffers->back(), vertexBufferMemSlots->back(), 0);
 			SDL_assert(result == VK_SUCCESS);
 
-			uint8_t * mappedMemory;
-			vkMapMemory(device, vertexBufferMemSlots->back(), 0, bufferInfo.size, 0, (void**)&mappedMemory);
-			
-			memcpy(mappedMemory, componentPtrs[c], bufferInfo.size);
-			vkUnmapMemory(device, vertexBufferMemSlots->back());
+			mappedVertexBuffers->push_back(nullptr);
+			result = vkMapMemory(device, vertexBufferMemSlots->back(), 0, bufferInfo.size, 0, (void**)&mappedVertexBuffers->back());
+			SDL_assert(result == VK_SUCCESS);
 		}
 		
 	}
 
+	// Both pipelines share the layout, which has room for procedural.vert's push constants.
+	void buildPipelineLayout() {
+		VkPushConstantRange pushConstantRange = {};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = sizeof(ProceduralEmitter);
+
+		VkPipelineLayoutCreateInfo layoutInfo = {};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		layoutInfo.pushConstantRangeCount = 1;
+		layoutInfo.pPushConstantRanges = &pushConstantRange;
+		SDL_assert_release(vkCreatePipelineLayout(device, &layoutInfo, nullptr, &pipelineLayout) == VK_SUCCESS);
+	}
+
 	void buildPipeline(
+		const char *vertexShaderPath,
 		const vector<VkVertexInputBindingDescription> &bindingDescs,
-		const vector<VkVertexInputAttributeDescription> &attribDescs) {
+		const vector<VkVertexInputAttributeDescription> &attribDescs,
+		VkPipeline *pipelineOut) {
 		
 		vector<VkPipelineShaderStageCreateInfo> shaderStages = {
-			buildShaderStage("basic_vert.spv", VK_SHADER_STAGE_VERTEX_BIT),
+			buildShaderStage(vertexShaderPath, VK_SHADER_STAGE_VERTEX_BIT),
 			buildShaderStage("basic_frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT)
 		};
 
@@ -423,10 +439,6 @@ namespace graphics {
 		colorBlending.attachmentCount = 1;
 		colorBlending.pAttachments = &colorBlendAttachment;
 
-		VkPipelineLayoutCreateInfo layoutInfo = {};
-		layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-		SDL_assert_release(vkCreatePipelineLayout(device, &layoutInfo, nullptr, &pipelineLayout) == VK_SUCCESS);
-
 		VkGraphicsPipelineCreateInfo pipelineInfo = {};
 		pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
 
@@ -454,7 +466,7 @@ namespace graphics {
 		pipelineInfo.layout = pipelineLayout;
 		pipelineInfo.renderPass = renderPass;
 		pipelineInfo.subpass = 0;
-		SDL_assert_release(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) == VK_SUCCESS);
+		SDL_assert_release(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, pipelineOut) == VK_SUCCESS);
 
 		for (auto &stage : shaderStages) vkDestroyShaderModule(device, stage.module, nullptr);
 	}
@@ -491,7 +503,7 @@ namespace graphics {
 
 		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 		poolInfo.queueFamilyIndex = queueFamilyIndex;
-		poolInfo.flags = 0;
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; // The procedural command buffers are recorded every frame
 		poolInfo.pNext = nullptr;
 
 		VkCommandPool commandPool = VK_NULL_HANDLE;
@@ -499,12 +511,7 @@ namespace graphics {
 		return commandPool;
 	}
 
-	void buildCommandBuffers(
-		VkCommandPool commandPool,
-		vector<VkBuffer> vertexBuffers,
-		uint32_t vertexCount,
-		vector<VkCommandBuffer> *commandBuffersOut) {
-
+	void allocateCommandBuffers(VkCommandPool commandPool, vector<VkCommandBuffer> *commandBuffersOut) {
 		commandBuffersOut->resize(framebuffers.size());
 
 		VkCommandBufferAllocateInfo bufferInfo = {};
@@ -514,7 +521,10 @@ namespace graphics {
 		bufferInfo.commandBufferCount = (int)commandBuffersOut->size();
 		auto result = vkAllocateCommandBuffers(device, &bufferInfo, commandBuffersOut->data());
 		SDL_assert(result == VK_SUCCESS);
+	}
 
+	// Begins recording commandBuffer and its render pass into framebuffers[framebufferIndex].
+	void beginRenderPass(VkCommandBuffer commandBuffer, uint32_t framebufferIndex) {
 		vector<VkClearValue> clearValues;
 
 		// Color clear value
@@ -529,26 +539,44 @@ namespace graphics {
 			clearValues.back().depthStencil = { 1, 0 };
 		}
 
-		for (int i = 0; i < commandBuffersOut->size(); i++) {
-			VkCommandBufferBeginInfo beginInfo = {};
-			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-			beginInfo.flags = 0; // TODO: optimisation possible?
-			beginInfo.pInheritanceInfo = nullptr;
-			result = vkBeginCommandBuffer((*commandBuffersOut)[i], &beginInfo);
-			SDL_assert(result == VK_SUCCESS);
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = 0; // TODO: optimisation possible?
+		beginInfo.pInheritanceInfo = nullptr;
+		auto result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+		SDL_assert(result == VK_SUCCESS);
+
+		VkRenderPassBeginInfo renderPassInfo = {};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassInfo.renderPass = renderPass;
+		renderPassInfo.framebuffer = framebuffers[framebufferIndex];
 
-			VkRenderPassBeginInfo renderPassInfo = {};
-			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-			renderPassInfo.renderPass = renderPass;
-			renderPassInfo.framebuffer = framebuffers[i];
+		renderPassInfo.clearValueCount = (uint32_t)clearValues.size();
+		renderPassInfo.pClearValues = clearValues.data();
+
+		renderPassInfo.renderArea.offset = { 0, 0 };
+		renderPassInfo.renderArea.extent = extent;
+
+		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	}
 
-			renderPassInfo.clearValueCount = (uint32_t)clearValues.size();
-			renderPassInfo.pClearValues = clearValues.data();
+	void endRenderPass(VkCommandBuffer commandBuffer) {
+		vkCmdEndRenderPass(commandBuffer);
+
+		auto result = vkEndCommandBuffer(commandBuffer);
+		SDL_assert(result == VK_SUCCESS);
+	}
+
+	void buildCommandBuffers(
+		VkCommandPool commandPool,
+		vector<VkBuffer> vertexBuffers,
+		uint32_t vertexCount,
+		vector<VkCommandBuffer> *commandBuffersOut) {
 
-			renderPassInfo.renderArea.offset = { 0, 0 };
-			renderPassInfo.renderArea.extent = extent;
+		allocateCommandBuffers(commandPool, commandBuffersOut);
 
-			vkCmdBeginRenderPass((*commandBuffersOut)[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+		for (int i = 0; i < commandBuffersOut->size(); i++) {
+			beginRenderPass((*commandBuffersOut)[i], i);
 			vkCmdBindPipeline((*commandBuffersOut)[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
 
 			vector<VkDeviceSize> offsets = {0,0,0,0};
@@ -556,13 +584,8 @@ namespace graphics {
 
 			vkCmdDraw((*commandBuffersOut)[i], vertexCount, 1, 0, 0);
 
-			vkCmdEndRenderPass((*commandBuffersOut)[i]);
-
-			result = vkEndCommandBuffer((*commandBuffersOut)[i]);
-			SDL_assert(result == VK_SUCCESS);
+			endRenderPass((*commandBuffersOut)[i]);
 		}
-
-		clearValues.resize(0);
 	}
 	
 	VkCommandBuffer buildAndBeginDepthTestingCommandBuffer(VkCommandPool commandPool) {
@@ -883,52 +906,61 @@ namespace graphics {
 		printf("\nInitialised Vulkan\n");
 
 		buildRenderPass();
-		buildPipeline(bindingDescs, attribDescs);
+		buildPipelineLayout();
+		buildPipeline("basic_vert.spv", bindingDescs, attribDescs, &pipeline);
 		commandPool = buildCommandPool(device, queueFamilyIndex);
 		if (enableDepthTesting) setupDepthTesting(commandPool);
 		buildFramebuffers();
 		buildSemaphores();
 	}
 
-	// Ephemeral render buffers
+	// Render buffers. The vertex buffers are only rebuilt when the particle capacity grows,
+	// and the command buffers only when the number of particles to draw changes.
 	vector<VkBuffer> vertexBuffers;
 	vector<VkDeviceMemory> vertexBufferMemSlots;
+	vector<float*> mappedVertexBuffers;
+	uint32_t vertexBufferCapacity = 0;
 	vector<VkCommandBuffer> commandBuffers;
+	uint32_t commandBufferVertexCount = 0;
 
-	void freeRenderBuffers() {
+	// Recorded every frame with the procedural emitters' push constants, one per framebuffer.
+	vector<VkCommandBuffer> proceduralCommandBuffers;
+
+	void freeCommandBuffers() {
 		vkFreeCommandBuffers(device, commandPool, (uint32_t)commandBuffers.size(), commandBuffers.data());
 		commandBuffers.resize(0);
+	}
+
+	void freeRenderBuffers() {
+		freeCommandBuffers();
 
 		for (auto &buffer : vertexBuffers) vkDestroyBuffer(device, buffer, nullptr);
 		vertexBuffers.resize(0);
 
-		for (auto &slot : vertexBufferMemSlots) vkFreeMemory(device, slot, nullptr);
+		for (auto &slot : vertexBufferMemSlots) {
+			vkUnmapMemory(device, slot);
+			vkFreeMemory(device, slot, nullptr);
+		}
 		vertexBufferMemSlots.resize(0);
+		mappedVertexBuffers.resize(0);
+		vertexBufferCapacity = 0;
 	}
 
-	void render(uint32_t particleCount, uint8_t componentCount, float *componentPtrs[]) {
-
-		if (!commandBuffers.empty()) {
-			// The queue may not have finished its commands from the last frame yet,
-			// so we wait for everything to be finished before rebuilding the buffers.
-			vkQueueWaitIdle(queue);
-			freeRenderBuffers();
-		}
-
-		buildVertexBuffers(particleCount, componentCount, componentPtrs, &vertexBuffers, &vertexBufferMemSlots);
-		buildCommandBuffers(commandPool, vertexBuffers, particleCount, &commandBuffers);
-
-		// Submit commands
+	uint32_t acquireSwapchainImage() {
 		uint32_t swapchainImageIndex = INT32_MAX;
 
 		auto result = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX /* no timeout */, imageAvailableSemaphore, VK_NULL_HANDLE, &swapchainImageIndex);
 		SDL_assert(result == VK_SUCCESS);
-		
+
+		return swapchainImageIndex;
+	}
+
+	void submitAndPresent(VkCommandBuffer commandBuffer, uint32_t swapchainImageIndex) {
 		VkSubmitInfo submitInfo = {};
 		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
 		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &commandBuffers[swapchainImageIndex];
+		submitInfo.pCommandBuffers = &commandBuffer;
 
 		submitInfo.waitSemaphoreCount = 1;
 		submitInfo.pWaitSemaphores = &imageAvailableSemaphore;
@@ -938,7 +970,7 @@ namespace graphics {
 		submitInfo.signalSemaphoreCount = 1;
 		submitInfo.pSignalSemaphores = &renderCompletedSemaphore;
 
-		result = vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+		auto result = vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
 		SDL_assert(result == VK_SUCCESS);
 
 		// Present
@@ -956,10 +988,71 @@ namespace graphics {
 		SDL_assert(result == VK_SUCCESS);
 	}
 
+	void render(uint32_t particleCount, uint32_t particleCapacity, uint8_t componentCount, float *componentPtrs[]) {
+
+		if (!commandBuffers.empty()) {
+			// The queue may not have finished its commands from the last frame yet,
+			// so we wait for everything to be finished before writing to the vertex buffers.
+			vkQueueWaitIdle(queue);
+		}
+
+		if (particleCapacity > vertexBufferCapacity || mappedVertexBuffers.size() != componentCount) {
+			freeRenderBuffers();
+			buildVertexBuffers(particleCapacity, componentCount, &vertexBuffers, &vertexBufferMemSlots, &mappedVertexBuffers);
+			vertexBufferCapacity = particleCapacity;
+		}
+
+		if (commandBuffers.empty() || particleCount != commandBufferVertexCount) {
+			freeCommandBuffers();
+			buildCommandBuffers(commandPool, vertexBuffers, particleCount, &commandBuffers);
+			commandBufferVertexCount = particleCount;
+		}
+
+		for (int c = 0; c < componentCount; c++) {
+			memcpy(mappedVertexBuffers[c], componentPtrs[c], sizeof(float) * particleCount);
+		}
+
+		uint32_t swapchainImageIndex = acquireSwapchainImage();
+		submitAndPresent(commandBuffers[swapchainImageIndex], swapchainImageIndex);
+	}
+
+	// The vertex shader evaluates the particles, so nothing is uploaded and there are no vertex buffers to draw from.
+	// Each emitter is one draw, with its own push constants.
+	void renderProcedural(uint32_t emitterCount, const ProceduralEmitter *emitters) {
+
+		// As in render(), the command buffer about to be recorded may still be executing.
+		vkQueueWaitIdle(queue);
+
+		// Built on first use, so that the other modes never need procedural_vert.spv
+		if (proceduralPipeline == VK_NULL_HANDLE) buildPipeline("procedural_vert.spv", {}, {}, &proceduralPipeline);
+		if (proceduralCommandBuffers.empty()) allocateCommandBuffers(commandPool, &proceduralCommandBuffers);
+
+		uint32_t swapchainImageIndex = acquireSwapchainImage();
+		VkCommandBuffer commandBuffer = proceduralCommandBuffers[swapchainImageIndex];
+
+		beginRenderPass(commandBuffer, swapchainImageIndex);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, proceduralPipeline);
+
+		for (uint32_t e = 0; e < emitterCount; e++) {
+			if (emitters[e].particleCount == 0) continue;
+
+			vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ProceduralEmitter), &emitters[e]);
+			vkCmdDraw(commandBuffer, emitters[e].particleCount, 1, 0, 0);
+		}
+
+		endRenderPass(commandBuffer);
+		submitAndPresent(commandBuffer, swapchainImageIndex);
+	}
+
 	void destroy() {
 		vkQueueWaitIdle(queue);
 		freeRenderBuffers();
 
+		if (!proceduralCommandBuffers.empty()) {
+			vkFreeCommandBuffers(device, commandPool, (uint32_t)proceduralCommandBuffers.size(), proceduralCommandBuffers.data());
+			proceduralCommandBuffers.resize(0);
+		}
+
 		vkDestroyCommandPool(device, commandPool, nullptr);
 
 		if (!requiredValidationLayers.empty()) {
@@ -976,6 +1069,7 @@ namespace graphics {
 		for (auto &buffer : framebuffers) vkDestroyFramebuffer(device, buffer, nullptr);
 		
 		vkDestroyPipeline(device, pipeline, nullptr);
+		vkDestroyPipeline(device, proceduralPipeline, nullptr);
 		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
 		vkDestroyRenderPass(device, renderPass, nullptr);
 
@@ -5,16 +5,81 @@ double getTime() {
 	return (SDL_GetPerformanceCounter() - startCount) / (double)SDL_GetPerformanceFrequency();
 }
 
-void monitorFramerate(float deltaTime) {
+void monitorFramerate(float deltaTime, double gridBuildTime) {
 	static vector<float> frameTimes;
+	static vector<double> gridBuildTimes;
 
 	frameTimes.push_back(deltaTime);
+	gridBuildTimes.push_back(gridBuildTime);
 
 	if (frameTimes.size() >= 100) {
 		float worstTime = 0;
 		for (auto time : frameTimes) if (time > worstTime) worstTime = time;
 		frameTimes.resize(0);
 		printf("Worst frame out of 100: %.2f ms (%.1f fps)\n", worstTime * 1000, 1 / worstTime);
+
+		double worstGridTime = 0, totalGridTime = 0;
+		for (auto time : gridBuildTimes) {
+			if (time > worstGridTime) worstGridTime = time;
+			totalGridTime += time;
+		}
+		printf("Neighbor grid build per frame: %.2f ms average, %.2f ms worst\n", totalGridTime * 1000 / gridBuildTimes.size(), worstGridTime * 1000);
+		gridBuildTimes.resize(0);
+	}
+}
+
+// Changes the simulation for a key press. Called through particles::enqueueChange(), as the simulation may be running
+// ahead of the display on its own thread.
+void handleKey(SDL_Keycode key) {
+	// F switches between ballistic particles and fluid.
+	if (key == SDLK_f) {
+		bool fluid = particles::getSimulationMode() != particles::SimulationMode::fluid;
+		particles::setSimulationMode(fluid ? particles::SimulationMode::fluid : particles::SimulationMode::ballistic);
+		printf("%s\n", fluid ? "Fluid" : "Ballistic");
+	}
+
+	// A switches between ballistic particles and analytic ones.
+	if (key == SDLK_a) {
+		bool analytic = particles::getSimulationMode() != particles::SimulationMode::analytic;
+		particles::setSimulationMode(analytic ? particles::SimulationMode::analytic : particles::SimulationMode::ballistic);
+		printf("%s\n", analytic ? "Analytic" : "Ballistic");
+	}
+
+	// P switches between ballistic particles and procedural ones, and V between evaluating the procedural
+	// particles in the vertex shader and on the CPU, to compare the two.
+	if (key == SDLK_p) {
+		bool procedural = particles::getSimulationMode() != particles::SimulationMode::procedural;
+		particles::setSimulationMode(procedural ? particles::SimulationMode::procedural : particles::SimulationMode::ballistic);
+		printf("%s\n", procedural ? "Procedural" : "Ballistic");
+	}
+
+	if (key == SDLK_v) {
+		particles::evaluateProceduralOnCpu = !particles::evaluateProceduralOnCpu;
+		printf("Procedural particles evaluated %s\n", particles::evaluateProceduralOnCpu ? "on the CPU" : "in the vertex shader");
+	}
+
+	// L turns on the update-rate LOD, adapting it to keep each step within 2 ms, and turns it off again.
+	if (key == SDLK_l) {
+		bool lod = particles::lodStepBudget == 0.0f;
+		particles::lodStepBudget = lod ? 0.002f : 0.0f;
+		if (!lod) particles::updateRateLod = 0.0f;
+		printf("Update-rate LOD %s\n", lod ? "on" : "off");
+	}
+
+	// Up and down double and halve the fountain's budget, right and left add and remove 1000.
+	uint32_t budget = particles::getEmitter(0).budget;
+	uint32_t newBudget = budget;
+
+	switch (key) {
+	case SDLK_UP: newBudget = budget * 2; break;
+	case SDLK_DOWN: newBudget = budget / 2; break;
+	case SDLK_RIGHT: newBudget = budget + 1000; break;
+	case SDLK_LEFT: newBudget = budget > 1000 ? budget - 1000 : 0; break;
+	}
+
+	if (newBudget != budget) {
+		particles::setEmitter(0, particles::defaultEmitter(newBudget));
+		printf("%u particles\n", particles::getParticleCount());
 	}
 }
 
@@ -28,9 +93,20 @@ int main(int argc, char* argv[]) {
 	SDL_assert_release(result == 0);
 
 	char *path = SDL_GetBasePath();
+#ifdef _WIN32
 	SDL_assert_release(SetCurrentDirectory(path));
+#else
+	SDL_assert_release(chdir(path) == 0);
+#endif
 	SDL_free(path);
 
+	// Run the simulation benchmarks without opening a window
+	if (argc > 1 && strcmp(argv[1], "-benchmark") == 0) {
+		benchmarks::run();
+		SDL_Quit();
+		return 0;
+	}
+
 	double appStartTime = getTime();
 
 	// create a 4:3 SDL window
@@ -61,13 +137,31 @@ int main(int argc, char* argv[]) {
 		while (SDL_PollEvent(&event)) {
 			switch (event.type) {
 			case SDL_QUIT: running = false; break;
+			case SDL_KEYDOWN: {
+				SDL_Keycode key = event.key.keysym.sym;
+
+				// 0 to 3 set how many frames the simulation may run ahead of the display.
+				if (key >= SDLK_0 && key <= SDLK_3) {
+					particles::setPipelineDepth(key - SDLK_0);
+					printf("Pipeline depth %u\n", particles::getPipelineDepth());
+				}
+				else particles::enqueueChange([key] { handleKey(key); });
+			} break;
 			}
 		}
+
+		// Sway the fountain from side to side
+		float swayX = -0.8f + sinf((float)getTime()) * 0.1f;
+		particles::enqueueChange([swayX] {
+			particles::Emitter fountain = particles::getEmitter(0);
+			fountain.position.x = swayX;
+			particles::setEmitter(0, fountain);
+		});
 		
-		particles::update(1000, deltaTime);
+		particles::update(deltaTime);
 		particles::render();
 
-		monitorFramerate(deltaTime);
+		monitorFramerate(deltaTime, particles::getGridBuildTime());
 	}
 
 	particles::destroy();
@@ -4,9 +4,25 @@
 #include <vector>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <atomic>
 #include <fstream>
 #include <random>
+#include <algorithm>
+
+#ifdef _WIN32
 #include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 
 #include <SDL.h>
 #include <SDL_vulkan.h>
@@ -16,9 +32,12 @@
 #include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
 #include <glm/mat4x4.hpp>
+#include <glm/geometric.hpp>
 
 #include <vulkan/vulkan.h>
 
+#include "simd.h"
+
 using namespace glm;
 using namespace std;
 
@@ -34,7 +53,25 @@ namespace graphics {
 		const vector<VkVertexInputBindingDescription> &bindingDesc,
 		const vector<VkVertexInputAttributeDescription> &attribDescs);
 	void destroy();
-	void render(uint32_t particleCount, uint8_t componentCount, float *componentPtrs[]);
+	void render(uint32_t particleCount, uint32_t particleCapacity, uint8_t componentCount, float *componentPtrs[]);
+
+	// The push constants of procedural.vert, which draws particleCount particles of an emitter from nothing but their
+	// indices. The layout matches the shader's push constant block, so every vec3 is packed with a float into a vec4.
+	struct ProceduralEmitter {
+		vec4 positionAndLifetime;
+		vec4 velocityAndSpawnInterval; // The seconds between the spawns of consecutive particles
+		vec4 coneTangentAndPeriod; // The seconds between the spawns of the same particle
+		vec4 coneBitangentAndPhase; // The seconds since the start of the current period
+		vec4 gravityAndDrag;
+		uint32_t drawKeys[4]; // Keys for the random numbers, as in particles.cpp
+		int32_t cycle; // The number of whole periods before the current one
+		float groundLevel;
+		float simulationSpeed;
+		uint32_t particleCount;
+	};
+
+	// Draws the emitters entirely in the vertex shader, with no vertex buffers.
+	void renderProcedural(uint32_t emitterCount, const ProceduralEmitter *emitters);
 }
 
 namespace particles {
@@ -43,8 +80,273 @@ namespace particles {
 		float brightness;
 	};
 
+	// How the particle attributes are arranged in memory
+	enum class ParticleLayout {
+		soa, // Structure of arrays: one array per attribute
+		aosoa8, // Array of structures of arrays: blocks of 8 particles, each holding all of their attributes contiguously
+		aosoa16 // As aosoa8, but with blocks of 16 particles
+	};
+
+	// How the velocities and brightness are stored. Positions are always 32-bit floats.
+	enum class StoragePrecision {
+		full, // 32-bit floats
+		half // 16-bit half floats, converted to and from floats as they are loaded and stored
+	};
+
+	// How updateRange() accesses memory
+	enum class MemoryAccess {
+		automatic, // Cached while the particles fit in the last level cache, otherwise prefetched
+		cached, // Plain loads and stores
+		prefetched // Software prefetches prefetchDistance particles ahead
+	};
+
 	void init(SDL_Window *window);
-	void update(int particleCount, float deltaTime);
+	void update(float deltaTime);
 	void render();
 	void destroy();
+
+	// Seconds the last update() spent building the neighbor grid, over all of its steps. With pipelining, those of the
+	// update whose frame render() last drew.
+	double getGridBuildTime();
+
+	// How many frames the simulation may run ahead of the frame being presented. 0, the default, simulates in update()
+	// and draws in render(), in turn on the calling thread. With 1 or more, update() queues its frame for a simulation
+	// thread and returns, and render() draws the frame of the update that many updates earlier, so that the simulation
+	// overlaps the copying and presentation, for that many frames of latency. The first frame is waited for and drawn
+	// until the next is due.
+	void setPipelineDepth(uint32_t depth);
+	uint32_t getPipelineDepth();
+
+	// Runs change before the next update() simulates, on the thread that simulates it, or at once without pipelining.
+	// Between init() and destroy(), whatever reads or changes the simulation must go through this while it is pipelined.
+	void enqueueChange(function<void()> change);
+
+	// A source of particles. Each emitter owns a contiguous range of budget particles and spawns into it in vectorized
+	// batches. Particles die when they reach their lifetime or fall below the ground, and only live particles are
+	// updated and drawn.
+	struct Emitter {
+		vec3 position;
+		vec3 velocity; // The axis of the velocity cone, with the speed along it as its length
+		float coneAngle; // The half-angle of the velocity cone in radians
+		float rate; // Particles spawned per second, while the emitter has fewer than budget live particles
+		float lifetime; // Seconds each particle lives, unless it falls below the ground first
+		uint32_t budget; // The most particles the emitter can have live at once
+	};
+
+	// The original fountain, with a lifetime a little longer than its particles take to reach the ground.
+	Emitter defaultEmitter(uint32_t budget);
+
+	// Emitters can be added and changed between updates. Changing an emitter's budget moves the ranges of the emitters
+	// after it, and every emitter keeps its live particles, but those of a smaller budget's dropped chunks. The particle
+	// count is the total of the budgets, plus padding between the ranges, of which the live particle count are in use.
+	uint32_t addEmitter(const Emitter &emitter);
+	void setEmitter(uint32_t emitterIndex, const Emitter &emitter);
+	Emitter getEmitter(uint32_t emitterIndex);
+	uint32_t getEmitterCount();
+	void removeAllEmitters();
+	uint32_t getParticleCount();
+	uint32_t getLiveParticleCount();
+
+	// The parameters of the forces, which can be changed between updates. Which of the forces are simulated is fixed at
+	// compile time by the Forces list in particles.cpp. Positive y is down.
+	struct Attractor {
+		vec3 position;
+		float strength; // Acceleration at unit distance, falling off with the square of the distance
+		float softening; // Added in quadrature to the distance, so that particles passing close aren't flung away
+	};
+
+	struct Vortex {
+		vec3 center;
+		vec3 axis; // Unit length. Particles swirl anticlockwise around it, looking along it.
+		float strength;
+		float softening;
+	};
+
+	struct Wind {
+		vec3 velocity;
+		float coupling; // How quickly particles are brought to the wind's velocity, per second
+	};
+
+	// Curl noise, which stirs the particles in eddies without bunching them together or spreading them apart. It is the sum
+	// of octaves of simplex noise, each with twice the frequency and half the strength of the one before.
+	struct Turbulence {
+		float strength; // Roughly the typical acceleration from the first octave
+		float frequency; // Noise cells per unit distance in the first octave
+		uint32_t octaves; // Up to maxTurbulenceOctaves. Each costs several times as much as the rest of the step.
+		vec3 drift; // The velocity the noise moves at, so that the eddies change over time
+	};
+
+	const int attractorCount = 2;
+	const uint32_t maxTurbulenceOctaves = 8;
+
+	struct ForceSettings {
+		vec3 gravity;
+		float linearDrag; // Deceleration per unit of speed
+		float quadraticDrag; // Deceleration per unit of speed squared
+		Attractor attractors[attractorCount];
+		Vortex vortex;
+		Wind wind;
+		Turbulence turbulence;
+	};
+
+	extern ForceSettings forceSettings;
+
+	// The colliders, which can be moved between updates. Which of them are simulated is fixed at compile time by the
+	// Colliders list in particles.cpp, and particles are kept outside all of them. A collider with zero size, or a
+	// plane with a zero normal, collides with nothing.
+	struct CollisionSurface {
+		float restitution; // The fraction of its speed towards the surface that a particle bounces back with
+		float friction; // The fraction of its speed along the surface that a particle loses when it hits
+	};
+
+	struct Plane {
+		vec3 normal; // Unit length, pointing out of the solid side
+		float offset; // Particles are kept where dot(normal, position) >= offset
+		CollisionSurface surface;
+	};
+
+	struct Sphere {
+		vec3 center;
+		float radius;
+		CollisionSurface surface;
+	};
+
+	struct Box {
+		vec3 center;
+		vec3 axes[3]; // Unit length and perpendicular to each other: the directions of the box's own x, y and z
+		vec3 halfExtents; // Along each of the axes
+		CollisionSurface surface;
+	};
+
+	const int planeColliderCount = 5;
+	const int sphereColliderCount = 1;
+	const int boxColliderCount = 1;
+
+	struct ColliderSettings {
+		Plane planes[planeColliderCount];
+		Sphere spheres[sphereColliderCount];
+		Box boxes[boxColliderCount];
+	};
+
+	extern ColliderSettings colliderSettings;
+
+	// In fluid mode the particles also push apart where they crowd together and drag their neighbors along with them,
+	// as a weakly compressible fluid simulated with smoothed particle hydrodynamics (SPH). Each particle interacts with
+	// those within one neighbor grid cell of it, so the grid is built every step whatever enableGrid is.
+	// In analytic mode the particles only feel gravity and linear drag, and each position is evaluated from where and
+	// when the particle spawned rather than stored, so a step writes nothing but the particles it spawns.
+	// In procedural mode nothing is stored at all. Each of an emitter's particles spawns in turn at its rate and
+	// respawns every budget / rate seconds, with random numbers hashed from its index and how many times it has
+	// respawned, so where it is is a function of the time alone. update() does nothing, and the vertex shader
+	// evaluates the positions unless evaluateProceduralOnCpu is set.
+	enum class SimulationMode {
+		ballistic, // Particles only feel the forces and colliders
+		fluid, // As ballistic, with the fluid's pressure and viscosity in place of the turbulence
+		analytic, // Gravity and linear drag only, with no colliders or grid
+		procedural // As analytic, with no particle state and no vertex buffers
+	};
+
+	struct FluidSettings {
+		float restDensity; // The density the fluid settles at
+		float particleMass; // With restDensity, sets how far apart the particles settle
+		float stiffness; // Pressure per unit of density above restDensity. Stiffer fluids compress less but are less stable.
+		float viscosity;
+		float joiningAge; // Seconds a particle must have lived before it joins the fluid, so that it has left its emitter's crowd
+	};
+
+	extern FluidSettings fluidSettings;
+
+	// Takes effect from the next update. Switching to or from procedural mode restarts the emitters.
+	void setSimulationMode(SimulationMode mode);
+	SimulationMode getSimulationMode();
+
+	// Evaluates procedural mode's particles on the CPU and draws them from the vertex buffers, as the other modes are
+	// drawn, rather than in procedural.vert. The two should draw the same frames, which tests the shader.
+	extern bool evaluateProceduralOnCpu;
+
+	// Update-rate level of detail, in ballistic mode. Chunks of particles that are far away or dim, by their depth and
+	// brightness, are updated every 2, 4 or 8 steps instead of every step, with a step as long as those they skipped,
+	// and are drawn moved along their velocities in between. With the colliders, every 2 steps at most, so that the
+	// longer steps don't carry particles through them. The higher updateRateLod, the more visible a chunk must be to
+	// be updated every step. 0 updates every particle every step.
+	extern float updateRateLod;
+	// When nonzero, each step raises updateRateLod if it took longer than this many seconds and lowers it if it took
+	// much less, so that crowded scenes lose detail rather than frames.
+	extern float lodStepBudget;
+
+	struct UpdateRateLodChange {
+		uint64_t step; // The step it took effect from, counting from 1 after initSimulation(), or 0 for the initial value
+		float updateRateLod;
+	};
+
+	// The value of updateRateLod at initSimulation() and the changes lodStepBudget made to it since. They follow the
+	// steps' durations, so they differ from run to run.
+	extern vector<UpdateRateLodChange> updateRateLodChanges;
+	// Sets updateRateLod from updateRateLodChanges rather than adapting it, so that the run they were recorded in is
+	// repeated exactly. initSimulation() keeps the changes while this is set.
+	extern bool replayUpdateRateLod;
+
+	// How each step advances the particles in ballistic and fluid mode. The analytic and procedural modes' paths are
+	// exact, so they have none.
+	enum class Integrator {
+		semiImplicitEuler, // First order, one force evaluation per step
+		velocityVerlet, // Second order, two force evaluations per step
+		midpoint // Second-order Runge-Kutta (RK2), two force evaluations per step
+	};
+
+	// Takes effect from the next update, with every layout, force list and collider setting.
+	void setIntegrator(Integrator integrator);
+	Integrator getIntegrator();
+
+	// Counters returned by each step, for benchmarking.
+	struct UpdateStats {
+		uint32_t spawnBatches; // Contiguous ranges spawned into
+		uint32_t spawnedParticles;
+		double gridBuildTime; // Seconds spent building the neighbor grid after the particles were updated
+		double fluidTime; // Seconds spent finding the fluid's densities and accelerations before the particles were updated
+		double reorderTime; // Seconds spent sorting the particles into Morton order, in the steps that do
+		uint32_t deferredParticles; // Live particles whose chunks the update-rate LOD skipped
+		double meanWakeLatency; // Seconds from a pass being started to the updater threads starting it, on the updater threads
+		double worstWakeLatency;
+		double threadImbalance; // The busiest thread's seconds in the update and fluid passes over the mean, 1 when balanced
+		uint32_t stolenTasks; // Tasks of those passes that work stealing moved between threads
+	};
+
+	// Used by benchmarks.cpp to run the simulation without graphics or updater threads.
+	extern simd::Level simdLevel; // May be lower than requested if the layout's blocks are narrower than the vectors
+	extern MemoryAccess requestedMemoryAccess;
+	extern MemoryAccess memoryAccess; // What requestedMemoryAccess resolved to for the current particle count
+	extern uint32_t prefetchDistance;
+	extern bool simulateAllForces; // Every force type rather than just the Forces list
+	extern bool simulateColliders; // False leaves the Colliders list out of the kernel, except in fluid mode
+	extern bool enableGrid; // Whether each step builds the neighbor grid
+	extern uint32_t reorderInterval; // Steps between sorting the particles into Morton order, or 0 for never
+	extern bool enableWorkStealing; // Whether the threads steal the update and fluid passes' tasks, or keep to their ranges
+	// Whether the threads are pinned to cores and the state's pages put on the nodes of the threads that update them.
+	// Takes effect from the next initSimulation() and startUpdaterThreads().
+	extern bool enableNumaPlacement;
+	// Starts with one defaultEmitter() whose budget is particleCount.
+	void initSimulation(uint32_t particleCount, ParticleLayout layout, simd::Level simdLevel, StoragePrecision precision = StoragePrecision::full);
+	UpdateStats simulateOnCallingThread(float deltaTime, uint32_t rangeCount = 1);
+	// Fills the arrays render() draws from, returning the number of particles in them.
+	uint32_t prepareRenderableParticles();
+	// Steps on threadCount threads, as update() does, for the benchmarks that measure scaling. The calling thread is
+	// one of them, so threadCount - 1 updater threads are started.
+	void startUpdaterThreads(uint32_t threadCount);
+	UpdateStats simulateOnUpdaterThreads(float deltaTime);
+	void stopUpdaterThreads();
+	uint64_t stateChecksum();
+	vec3 getParticlePosition(uint32_t particleIndex);
+	// Misses per particle in a model of a 32 KB 8-way cache, reading the positions in the grid's order as the
+	// fluid's passes do. Measures how scattered neighbors are in memory, where hardware counters aren't available.
+	double simulateGridCacheMisses();
+	bool isParticleLive(uint32_t particleIndex);
+	uint32_t getNumaNodeCount();
+	// The fraction of the state's pages in the threads' ranges of the last update pass that are on another node than
+	// the thread that updated them. Each of those pages is read and written across the sockets every step.
+	double findRemoteStateFraction();
+}
+
+namespace benchmarks {
+	void run();
 }
\ No newline at end of file
@@ -1,46 +1,641 @@
 #include "main.h"
 
+#ifdef _WIN32
+#pragma comment(lib, "Synchronization.lib") // WaitOnAddress() and WakeByAddressAll()
+#pragma comment(lib, "Psapi.lib") // QueryWorkingSetEx()
+#endif
+
 namespace particles {
 
+	// The number of particles in the emitters' ranges, live or not, which may be any number up to particleCapacity.
 	uint32_t particleCount = 500000;
-	uint32_t m256Count;
-	const uint32_t floatsPerM256 = 8;
+
+	// The number of particles there is storage for, always a multiple of the widest vector (and so of every
+	// layout's block size). The lanes between particleCount and particleCapacity are never live.
+	uint32_t particleCapacity = 0;
 
 	Particle * renderableParticles;
 
-	vector<__m256> positionsX;
-	vector<__m256> positionsY;
-	vector<__m256> positionsZ;
+	// The per-particle attributes, in the order they are laid out within each AoSoA block.
+	// Brightness is last because updateRange() rarely touches it, so with 16-particle blocks
+	// it sits in its own cache line and isn't pulled in alongside the attributes updated every step.
+	// Age and lifetime are before the velocities so that they stay floats in half precision: age accumulates like the
+	// positions, and with lifetime the halves come in whole vectors' worth of bytes, which keeps the AoSoA blocks aligned.
+	enum Attribute { positionX, positionY, positionZ, age, lifetime, velocityX, velocityY, velocityZ, brightness, attributeCount };
+
+	// The layout the application runs with. The AoSoA layouts keep all the attributes of a block of particles
+	// in one contiguous run of memory, so updateRange() reads one memory stream instead of seven.
+	const ParticleLayout defaultLayout = ParticleLayout::soa;
+	ParticleLayout layout = defaultLayout;
+
+	// How the velocities and brightness are stored. Half precision cuts the bytes updateRange() moves per particle by a quarter.
+	const StoragePrecision defaultPrecision = StoragePrecision::full;
+	StoragePrecision precision = defaultPrecision;
+
+	// The memory access updateRange() uses, chosen by selectUpdateRangeFunction() when requestedMemoryAccess is automatic.
+	MemoryAccess requestedMemoryAccess = MemoryAccess::automatic;
+	MemoryAccess memoryAccess = MemoryAccess::cached;
+
+	// How far ahead of the particle being updated the prefetching kernels prefetch, in particles.
+	// Must be a multiple of simd::maxWidth. benchmarks.cpp sweeps it to find a good value.
+	uint32_t prefetchDistance = 256;
+
+	// The instruction set updateRange() runs with, chosen at startup from what the CPU supports.
+	simd::Level simdLevel = simd::Level::scalar;
+
+	// All attributes of all particles, arranged according to layout and precision, in stateBytes of allocatePages().
+	uint8_t *state = nullptr;
+	size_t stateBytes = 0;
+
+	// Separate x, y, z and brightness arrays for graphics::render(), holding just the live particles.
+	vector<float> renderableComponents[4];
+
+	// The size of each attribute and its offset within one particle's worth of attributes.
+	struct FullPrecision {
+		static const uint32_t bytesPerParticle = attributeCount * sizeof(float);
+
+		static uint32_t size(Attribute) { return sizeof(float); }
+		static uint32_t offset(Attribute attribute) { return attribute * sizeof(float); }
+	};
+
+	// Positions and age stay as floats because their rounding errors would accumulate from step to step.
+	// Lifetime is a float too, for the alignment of the AoSoA blocks.
+	struct HalfPrecision {
+		static const uint32_t bytesPerParticle = velocityX * sizeof(float) + (attributeCount - velocityX) * sizeof(uint16_t);
+
+		static uint32_t size(Attribute attribute) { return attribute < velocityX ? sizeof(float) : sizeof(uint16_t); }
+
+		static uint32_t offset(Attribute attribute) {
+			if (attribute < velocityX) return attribute * sizeof(float);
+			return velocityX * sizeof(float) + (attribute - velocityX) * sizeof(uint16_t);
+		}
+	};
+
+	template<typename AttributePrecision>
+	struct SoALayout {
+		typedef AttributePrecision Precision;
+		static const uint32_t blockSize = simd::maxWidth;
+
+		static uint8_t *find(uint8_t *state, uint32_t capacity, Attribute attribute, uint32_t particleIndex) {
+			return state + (size_t)Precision::offset(attribute) * capacity + (size_t)particleIndex * Precision::size(attribute);
+		}
+
+		// Prefetches the attributes updateRange() reads for simd::maxWidth particles, one cache line per attribute.
+		static void prefetch(uint8_t *state, uint32_t capacity, uint32_t particleIndex) {
+			for (int a = positionX; a <= velocityZ; a++) simd::prefetch(find(state, capacity, (Attribute)a, particleIndex));
+		}
+	};
+
+	template<uint32_t particlesPerBlock, typename AttributePrecision>
+	struct AoSoALayout {
+		typedef AttributePrecision Precision;
+		static const uint32_t blockSize = particlesPerBlock;
+
+		static uint8_t *find(uint8_t *state, uint32_t /*capacity*/, Attribute attribute, uint32_t particleIndex) {
+			uint32_t block = particleIndex / blockSize;
+			uint32_t indexInBlock = particleIndex % blockSize;
+			return state + (size_t)block * blockSize * Precision::bytesPerParticle
+				+ Precision::offset(attribute) * blockSize + indexInBlock * Precision::size(attribute);
+		}
+
+		// Prefetches simd::maxWidth particles, which are contiguous in this layout.
+		static void prefetch(uint8_t *state, uint32_t capacity, uint32_t particleIndex) {
+			uint8_t *start = find(state, capacity, positionX, particleIndex);
+			for (uint32_t offset = 0; offset < simd::maxWidth * Precision::bytesPerParticle; offset += 64) simd::prefetch(start + offset);
+		}
+	};
+
+	template<typename Precision>
+	uint8_t *findAttributeWith(Attribute attribute, uint32_t particleIndex) {
+		switch (layout) {
+		case ParticleLayout::aosoa8: return AoSoALayout<8, Precision>::find(state, particleCapacity, attribute, particleIndex);
+		case ParticleLayout::aosoa16: return AoSoALayout<16, Precision>::find(state, particleCapacity, attribute, particleIndex);
+		default: return SoALayout<Precision>::find(state, particleCapacity, attribute, particleIndex);
+		}
+	}
+
+	// Enables indexing into the state by particle index in any layout and precision. Slow, so don't do it often.
+	uint8_t *findAttribute(Attribute attribute, uint32_t particleIndex) {
+		if (precision == StoragePrecision::half) return findAttributeWith<HalfPrecision>(attribute, particleIndex);
+		return findAttributeWith<FullPrecision>(attribute, particleIndex);
+	}
+
+	uint32_t attributeSize(Attribute attribute) {
+		return precision == StoragePrecision::half ? HalfPrecision::size(attribute) : FullPrecision::size(attribute);
+	}
+
+	uint32_t attributeOffset(Attribute attribute) {
+		return precision == StoragePrecision::half ? HalfPrecision::offset(attribute) : FullPrecision::offset(attribute);
+	}
+
+	uint32_t bytesPerParticle() {
+		return precision == StoragePrecision::half ? HalfPrecision::bytesPerParticle : FullPrecision::bytesPerParticle;
+	}
+
+	float getAttribute(Attribute attribute, uint32_t particleIndex) {
+		uint8_t *address = findAttribute(attribute, particleIndex);
+		if (attributeSize(attribute) == sizeof(uint16_t)) return simd::halfToFloat(*(uint16_t*)address);
+		return *(float*)address;
+	}
 
-	// TODO: Brightnesses are only updated on a per-float basis, so just make it a vector of floats?
-	vector<__m256> brightnesses;
+	void setAttribute(Attribute attribute, uint32_t particleIndex, float value) {
+		uint8_t *address = findAttribute(attribute, particleIndex);
+		if (attributeSize(attribute) == sizeof(uint16_t)) *(uint16_t*)address = simd::floatToHalf(value);
+		else *(float*)address = value;
+	}
 
-	vector<__m256> velocitiesX;
-	vector<__m256> velocitiesY;
-	vector<__m256> velocitiesZ;
+	// Copies an attribute of count particles, which must not cross the end of a block, converting it to floats if necessary.
+	void copyAttributeAsFloats(Attribute attribute, uint32_t firstParticle, uint32_t count, float *destination) {
+		uint8_t *source = findAttribute(attribute, firstParticle);
+		if (attributeSize(attribute) == sizeof(uint16_t)) simd::halvesToFloats((uint16_t*)source, destination, count);
+		else memcpy(destination, source, sizeof(float) * count);
+	}
 
-	// Enables indexing into the arrays by particle index. Slow, so don't do it often.
-#define M256s_TO_FLOATS(arrayName) ((float*)arrayName.data())
+	uint32_t blockSizeOfLayout(ParticleLayout layout) {
+		switch (layout) {
+		case ParticleLayout::aosoa8: return AoSoALayout<8, FullPrecision>::blockSize;
+		case ParticleLayout::aosoa16: return AoSoALayout<16, FullPrecision>::blockSize;
+		default: return SoALayout<FullPrecision>::blockSize;
+		}
+	}
 
+	// The thread stepping the simulation works as thread 0 of each pass, and the updater threads are threads 1 and up,
+	// so that no core waits idle while the others work. steppingThreadCount counts all of them, or is 0 when stopped.
 	vector<thread> updaterThreads;
-	HANDLE updateStartSemaphore = NULL;
-	HANDLE updateEndSemaphore = NULL;
-	void updaterThread(uint32_t startIndex, uint32_t endIndexExclusive);
+	uint32_t steppingThreadCount = 0;
+	void updaterThread(uint32_t threadIndex);
 	bool updaterThreadsShouldReturn = false;
 
-	float randf() {
-		static mt19937 randomGen((unsigned int)SDL_GetPerformanceCounter());
+	// What the updater threads do each time they are started: one pass of a step, given the thread's index and the thread count.
+	typedef void(*UpdaterPass)(uint32_t threadIndex, uint32_t threadCount);
+	UpdaterPass updaterPass = nullptr;
+
+	// The updater threads and the thread stepping them meet at a sense-reversing barrier before and after each pass.
+	// Each arrival flips the arriving thread's own sense, and the last to arrive resets the count and publishes its
+	// sense, which releases the rest. Passes within a step follow each other within microseconds, so waiting threads
+	// spin for a while before they sleep on the sense with a futex, and the last to arrive only makes a system call
+	// to wake them if any are asleep.
+	struct Barrier {
+		atomic<uint32_t> remaining;
+		atomic<uint32_t> sense;
+		atomic<uint32_t> sleeperCount;
+		uint32_t participantCount;
+		uint32_t spinCount; // 0 with a single hardware thread, where spinning only delays the thread being waited for
+	};
+
+	Barrier updaterBarrier;
+	uint32_t steppingThreadSense = 0; // The sense of the thread stepping the updater threads
+	const uint32_t barrierSpinCount = 4000;
+
+	// Sleeps until *address may no longer hold value, returning at once if it already doesn't. May return spuriously.
+	void waitOnAddress(atomic<uint32_t> *address, uint32_t value) {
+#ifdef _WIN32
+		WaitOnAddress(address, &value, sizeof(value), INFINITE);
+#else
+		syscall(SYS_futex, (uint32_t*)address, FUTEX_WAIT_PRIVATE, value, nullptr, nullptr, 0);
+#endif
+	}
+
+	void wakeAllOnAddress(atomic<uint32_t> *address) {
+#ifdef _WIN32
+		WakeByAddressAll(address);
+#else
+		syscall(SYS_futex, (uint32_t*)address, FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+#endif
+	}
+
+	void resetBarrier(Barrier &barrier, uint32_t participantCount) {
+		barrier.remaining = participantCount;
+		barrier.sense = 0;
+		barrier.sleeperCount = 0;
+		barrier.participantCount = participantCount;
+		barrier.spinCount = thread::hardware_concurrency() > 1 ? barrierSpinCount : 0;
+	}
+
+	// Returns once every participant has arrived. localSense is the participant's own, starting at 0.
+	void arriveAtBarrier(Barrier &barrier, uint32_t &localSense) {
+		localSense = 1 - localSense;
+
+		if (barrier.remaining.fetch_sub(1) == 1) {
+			barrier.remaining.store(barrier.participantCount, memory_order_relaxed);
+			barrier.sense.store(localSense);
+			if (barrier.sleeperCount.load() > 0) wakeAllOnAddress(&barrier.sense);
+			return;
+		}
+
+		for (uint32_t i = 0; i < barrier.spinCount; i++) {
+			if (barrier.sense.load(memory_order_acquire) == localSense) return;
+			_mm_pause();
+		}
+
+		// The sleeper count is raised before the sense is checked again, and the sense is published before the count is
+		// read, so either the waker sees the sleeper or the sleeper sees the new sense.
+		barrier.sleeperCount++;
+		while (barrier.sense.load() != localSense) waitOnAddress(&barrier.sense, 1 - localSense);
+		barrier.sleeperCount--;
+	}
+
+	// When the current pass was started, and how long each updater thread took to start it. Each thread's times are
+	// padded to a cache line of their own, so that recording them doesn't slow the other threads.
+	double passStartTime = 0.0;
+
+	struct WakeLatencies {
+		double total;
+		double worst;
+		uint32_t count;
+		uint8_t padding[64 - 2 * sizeof(double) - sizeof(uint32_t)];
+	};
+
+	vector<WakeLatencies> updaterWakeLatencies;
+
+	// Work stealing, for the passes whose cost varies most between ranges of equal size: the update, where spawning and
+	// the update-rate LOD cluster in some chunks, and the fluid's, where crowded cells have more neighbors. Each thread
+	// starts with the range its pass would have given it, cut into tasks of a few cache-sized chunks or blocks of slots,
+	// and a thread that runs out steals the back half of another's remaining tasks. Each thread's remaining tasks are a
+	// deque packed into one atomic, the first in the low 32 bits and the end in the high, so the owner taking tasks from
+	// the front and thieves taking them from the back each claim theirs with a compare and swap. Every deque is empty at
+	// the end of a pass, so each thread fills its own as it starts the next and thieves skip those not filled yet.
+	bool enableWorkStealing = true;
+
+	struct TaskDeque {
+		atomic<uint64_t> tasks;
+		double busyTime; // Seconds the thread spent in this step's scheduled passes
+		uint32_t stolenTasks;
+		uint8_t padding[64 - sizeof(atomic<uint64_t>) - sizeof(double) - sizeof(uint32_t)];
+	};
+
+	// One for each of the threads or ranges stepping the simulation, reset by prepareTaskDeques() at the start of each step.
+	TaskDeque *taskDeques = nullptr;
+	uint32_t taskDequeCount = 0;
+
+	uint64_t packTasks(uint32_t firstTask, uint32_t endTaskExclusive) {
+		return ((uint64_t)endTaskExclusive << 32) | firstTask;
+	}
+
+	void prepareTaskDeques(uint32_t threadCount) {
+		if (taskDequeCount < threadCount) {
+			delete[] taskDeques;
+			taskDeques = new TaskDeque[threadCount];
+			taskDequeCount = threadCount;
+		}
+
+		for (uint32_t t = 0; t < taskDequeCount; t++) {
+			taskDeques[t].tasks.store(0, memory_order_relaxed);
+			taskDeques[t].busyTime = 0.0;
+			taskDeques[t].stolenTasks = 0;
+		}
+	}
+
+	bool takeTask(TaskDeque &deque, uint32_t *task) {
+		uint64_t tasks = deque.tasks.load(memory_order_relaxed);
+
+		while (true) {
+			uint32_t first = (uint32_t)tasks, end = (uint32_t)(tasks >> 32);
+			if (first >= end) return false;
+
+			if (deque.tasks.compare_exchange_weak(tasks, packTasks(first + 1, end))) {
+				*task = first;
+				return true;
+			}
+		}
+	}
+
+	// Moves the back half of the nearest other deque with tasks left into the thief's own, which is empty. The threads
+	// are pinned to the cores in node order, so the nearest threads are the most likely to share the thief's node.
+	bool stealTasks(uint32_t thiefIndex, uint32_t threadCount) {
+		for (uint32_t i = 1; i < 2 * threadCount; i++) {
+			// Alternately after and before the thief. An index before thread 0 underflows past the last thread and is
+			// skipped, as the threads there are reached by the search after the thief.
+			uint32_t distance = (i + 1) / 2;
+			uint32_t victimIndex = i % 2 == 1 ? thiefIndex + distance : thiefIndex - distance;
+			if (victimIndex >= threadCount) continue;
+
+			TaskDeque &victim = taskDeques[victimIndex];
+			uint64_t tasks = victim.tasks.load(memory_order_relaxed);
+
+			while (true) {
+				uint32_t first = (uint32_t)tasks, end = (uint32_t)(tasks >> 32);
+				if (first >= end) break;
+
+				uint32_t newEnd = end - (end - first + 1) / 2;
+				if (!victim.tasks.compare_exchange_weak(tasks, packTasks(first, newEnd))) continue;
+
+				TaskDeque &thief = taskDeques[thiefIndex];
+				thief.stolenTasks += end - newEnd;
+				thief.tasks.store(packTasks(newEnd, end));
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	typedef void(*ScheduledRangeFunction)(uint32_t first, uint32_t endExclusive);
+
+	// Runs function on the thread's range of the itemCount items of a pass, [first, endExclusive), and then on whatever
+	// it can steal from the other threads, in tasks of itemsPerTask items. The range is rounded to whole tasks.
+	void runScheduledRange(uint32_t threadIndex, uint32_t threadCount, uint32_t first, uint32_t endExclusive,
+		uint32_t itemCount, uint32_t itemsPerTask, ScheduledRangeFunction function) {
+
+		double startTime = getTime();
+		TaskDeque &deque = taskDeques[threadIndex];
+
+		if (!enableWorkStealing) function(first, endExclusive);
+		else {
+			deque.tasks.store(packTasks((first + itemsPerTask - 1) / itemsPerTask, (endExclusive + itemsPerTask - 1) / itemsPerTask));
+			uint32_t task;
+
+			do {
+				while (takeTask(deque, &task)) {
+					uint32_t taskEnd = (task + 1) * itemsPerTask;
+					function(task * itemsPerTask, taskEnd < itemCount ? taskEnd : itemCount);
+				}
+			} while (stealTasks(threadIndex, threadCount));
+		}
+
+		deque.busyTime += getTime() - startTime;
+	}
+
+	// The busiest thread's time in the scheduled passes over the mean of all of them, and the tasks they stole.
+	void findSchedulingStats(uint32_t threadCount, UpdateStats &stats) {
+		double totalBusyTime = 0.0, worstBusyTime = 0.0;
+
+		for (uint32_t t = 0; t < threadCount; t++) {
+			totalBusyTime += taskDeques[t].busyTime;
+			if (taskDeques[t].busyTime > worstBusyTime) worstBusyTime = taskDeques[t].busyTime;
+			stats.stolenTasks += taskDeques[t].stolenTasks;
+		}
+
+		stats.threadImbalance = totalBusyTime > 0.0 ? worstBusyTime * threadCount / totalBusyTime : 1.0;
+	}
+
+	// NUMA placement. The threads stepping the simulation are pinned to the cores in node order, so that consecutive
+	// threads share a node, and the state's pages are allocated untouched and first touched by the thread whose share
+	// of the particles they hold, so that the OS puts them on that thread's node. Off, the threads float between the
+	// cores and the state is zeroed by the thread that allocates it, as it was before.
+	bool enableNumaPlacement = true;
+
+	// The cores the process may run on, in node order, and the node of each core by its number.
+	struct CpuTopology {
+		vector<uint32_t> cpus;
+		vector<uint32_t> nodeOfCpu;
+		uint32_t nodeCount;
+	};
+
+#ifndef _WIN32
+	// Calls found with each number in a sysfs list of ranges, such as "0-15,32-47". Returns false without the file.
+	template<typename Found>
+	bool readRangeList(const char *path, Found found) {
+		FILE *file = fopen(path, "r");
+		if (!file) return false;
+
+		int first, last;
+		while (fscanf(file, "%d", &first) == 1) {
+			if (fscanf(file, "-%d", &last) != 1) last = first;
+			for (int number = first; number <= last; number++) found(number);
+			if (fgetc(file) != ',') break;
+		}
+
+		fclose(file);
+		return true;
+	}
+#endif
+
+	CpuTopology findCpuTopology() {
+		CpuTopology topology = {};
+
+#ifdef _WIN32
+		// Only the first processor group, of up to 64 cores, is used.
+		DWORD_PTR processMask, systemMask;
+		GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask);
+		DWORD cpuCount = GetActiveProcessorCount(0);
+		topology.nodeOfCpu.assign(64, 0);
+
+		for (DWORD cpu = 0; cpu < cpuCount && cpu < 64; cpu++) {
+			PROCESSOR_NUMBER number = { 0, (BYTE)cpu, 0 };
+			USHORT node = 0;
+			if (GetNumaProcessorNodeEx(&number, &node)) topology.nodeOfCpu[cpu] = node;
+			if (processMask & ((DWORD_PTR)1 << cpu)) topology.cpus.push_back(cpu);
+		}
+#else
+		// The online nodes and each node's cores are listed as ranges. Without them, every core is on node 0.
+		topology.nodeOfCpu.assign(CPU_SETSIZE, 0);
+
+		readRangeList("/sys/devices/system/node/online", [&](int node) {
+			char path[64];
+			snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+			readRangeList(path, [&](int cpu) { if (cpu < CPU_SETSIZE) topology.nodeOfCpu[cpu] = node; });
+		});
+
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		sched_getaffinity(0, sizeof(allowed), &allowed);
+		for (uint32_t cpu = 0; cpu < CPU_SETSIZE; cpu++) if (CPU_ISSET(cpu, &allowed)) topology.cpus.push_back(cpu);
+#endif
+
+		if (topology.cpus.empty()) topology.cpus.push_back(0);
+		stable_sort(topology.cpus.begin(), topology.cpus.end(), [&](uint32_t a, uint32_t b) { return topology.nodeOfCpu[a] < topology.nodeOfCpu[b]; });
+
+		for (size_t i = 0; i < topology.cpus.size(); i++) {
+			if (i == 0 || topology.nodeOfCpu[topology.cpus[i]] != topology.nodeOfCpu[topology.cpus[i - 1]]) topology.nodeCount++;
+		}
+
+		return topology;
+	}
+
+	const CpuTopology &getCpuTopology() {
+		static const CpuTopology topology = findCpuTopology();
+		return topology;
+	}
+
+	uint32_t getNumaNodeCount() {
+		return getCpuTopology().nodeCount;
+	}
+
+	// The node of the core the calling thread is running on, which may change at any time unless it is pinned.
+	uint32_t findCurrentNode() {
+#ifdef _WIN32
+		PROCESSOR_NUMBER number;
+		GetCurrentProcessorNumberEx(&number);
+		USHORT node = 0;
+		GetNumaProcessorNodeEx(&number, &node);
+		return node;
+#else
+		int cpu = sched_getcpu();
+		return cpu >= 0 && cpu < CPU_SETSIZE ? getCpuTopology().nodeOfCpu[cpu] : 0;
+#endif
+	}
+
+	// The core for thread threadIndex of threadCount. The threads are spread evenly over the cores in node order, so
+	// that each node's threads update a contiguous share of the particles.
+	uint32_t findCpuForThread(uint32_t threadIndex, uint32_t threadCount) {
+		const CpuTopology &topology = getCpuTopology();
+		return topology.cpus[(uint64_t)threadIndex * topology.cpus.size() / threadCount];
+	}
+
+	void pinThread(uint32_t threadIndex, uint32_t threadCount) {
+		uint32_t cpu = findCpuForThread(threadIndex, threadCount);
+
+#ifdef _WIN32
+		SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu);
+#else
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#endif
+	}
+
+	// The stepping thread is pinned while the updater threads run, and given back the cores it had when they stop.
+#ifdef _WIN32
+	DWORD_PTR steppingThreadAffinity = 0;
+#else
+	cpu_set_t steppingThreadAffinity;
+#endif
+	bool steppingThreadIsPinned = false;
 
-		// Generate a number and remove the lower offset.
-		float randomNumber = randomGen() - randomGen.min();
+	void pinSteppingThread(uint32_t threadCount) {
+#ifdef _WIN32
+		steppingThreadAffinity = SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << findCpuForThread(0, threadCount));
+#else
+		pthread_getaffinity_np(pthread_self(), sizeof(steppingThreadAffinity), &steppingThreadAffinity);
+		pinThread(0, threadCount);
+#endif
+		steppingThreadIsPinned = true;
+	}
+
+	void unpinSteppingThread() {
+		if (!steppingThreadIsPinned) return;
+
+#ifdef _WIN32
+		SetThreadAffinityMask(GetCurrentThread(), steppingThreadAffinity);
+#else
+		pthread_setaffinity_np(pthread_self(), sizeof(steppingThreadAffinity), &steppingThreadAffinity);
+#endif
+		steppingThreadIsPinned = false;
+	}
+
+	// Zeroed, page-aligned memory whose pages aren't put on a node until they are first touched.
+	uint8_t *allocatePages(size_t size) {
+#ifdef _WIN32
+		void *memory = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+		void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED) memory = nullptr;
+#endif
+		SDL_assert_release(memory);
+		return (uint8_t*)memory;
+	}
+
+	void freePages(uint8_t *memory, size_t size) {
+		if (!memory) return;
+
+#ifdef _WIN32
+		VirtualFree(memory, 0, MEM_RELEASE);
+#else
+		munmap(memory, size);
+#endif
+	}
+
+	// The node each of the threads stepping the simulation ran the last update pass on, for findRemoteStateFraction().
+	vector<uint32_t> updateThreadNodes;
+
+	// Seconds spent building the neighbor grid in the last update(), over all of its steps.
+	double lastUpdateGridBuildTime = 0.0;
+
+	// Whether the neighbor grid holds the particles as they are now. Laying out the emitters moves and kills particles.
+	bool gridIsCurrent = false;
 
-		// Calculate the range of possible values.
-		float range = randomGen.max() - randomGen.min();
+	void selectUpdateRangeFunction(simd::Level requestedLevel);
+	void selectFluidFunctions(simd::Level level);
 
-		// Return a random number in the range 0.0f-1.0f.
-		return randomNumber / range;
+	// Seed for the spawn random numbers. A run can always be reproduced from it, whatever the thread count.
+	const uint64_t randomSeed = 0x5EED5EED5EED5EEDull;
+
+	uint64_t splitMix64(uint64_t &seedState) {
+		uint64_t z = (seedState += 0x9E3779B97F4A7C15ull);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
 	}
 
+	// The number of random floats drawn for each spawning particle
+	const int randomDrawsPerSpawn = 4;
+
+	// Counter-based random numbers: each one is a hash of the particle's index and a key unique to the step and draw.
+	// A particle's randoms don't depend on which thread updates it or on what was drawn before it, so the
+	// simulation is bit-identical however the particles are divided between threads.
+	template<typename Simd>
+	struct RandomGenerator {
+		typedef typename Simd::Int Int;
+
+		uint32_t drawKeys[randomDrawsPerSpawn];
+
+		RandomGenerator(uint64_t step) {
+			uint64_t splitMixState = randomSeed ^ (step * 0xD1B54A32D192ED03ull);
+			for (auto &key : drawKeys) key = (uint32_t)splitMix64(splitMixState);
+		}
+
+		// Returns Simd::width random numbers in the range 0.0f-1.0f (exclusive of 1.0f),
+		// one for each particle starting at firstParticle.
+		typename Simd::Float nextFloats(uint32_t firstParticle, int draw) {
+			Int bits = Simd::addInt(Simd::mulInt(Simd::laneIndices(firstParticle), Simd::setInt(0x9E3779B9)), Simd::setInt(drawKeys[draw]));
+
+			// The MurmurHash3 finalizer
+			bits = Simd::xorInt(bits, Simd::template shiftRight<16>(bits));
+			bits = Simd::mulInt(bits, Simd::setInt(0x85EBCA6B));
+			bits = Simd::xorInt(bits, Simd::template shiftRight<13>(bits));
+			bits = Simd::mulInt(bits, Simd::setInt(0xC2B2AE35));
+			bits = Simd::xorInt(bits, Simd::template shiftRight<16>(bits));
+
+			return Simd::unitFloats(bits);
+		}
+	};
+
+	ForceSettings forceSettings = {
+		vec3(0.0f, 1.0f, 0.0f), // gravity
+		0.1f, // linearDrag
+		0.0f, // quadraticDrag
+		{}, // attractors
+		{}, // vortex
+		{}, // wind
+		{ 0.6f, 2.0f, 2, vec3(0.0f, -0.3f, 0.0f) } // turbulence
+	};
+
+	const float groundLevel = 1.0f;
+	float stepSize = 0.0f;
+
+	// The number of steps taken since initSimulation(), used to key the random numbers.
+	uint64_t stepIndex = 0;
+
+	// How many of updateRateLodChanges the steps since initSimulation() have replayed.
+	size_t replayedLodChanges = 0;
+
+	// Simulated seconds since initSimulation(), which move the turbulence.
+	double simulatedTime = 0.0;
+
+	// Real seconds since initSimulation(), which the analytic mode's spawn times are measured in.
+	double elapsedTime = 0.0;
+
+	// Simulated time passes at this fraction of real time.
+	const float simulationSpeed = 0.5f;
+
+	// With a fixed timestep, update() advances the simulation in whole steps of fixedStepDuration and carries
+	// the remainder over to the next frame, so the results don't depend on the frame rate.
+	bool enableFixedTimestep = true;
+	const float fixedStepDuration = 1 / 120.0f;
+
+	// Caps the cost of a frame after a stall. Time beyond this many steps is dropped and the simulation falls behind.
+	const int maxStepsPerUpdate = 8;
+
+	// Also caps the cost of a frame when steps take longer than the time they simulate, as fluid steps of hundreds of
+	// thousands of particles can, since catching up would only make the next frame longer. No further step starts once
+	// an update has spent this many seconds stepping, and the rest of its time is dropped.
+	const double maxUpdateDuration = 1 / 30.0;
+
+	// Real time not yet simulated because it is less than a fixed step.
+	double unsimulatedTime = 0.0;
+
 	void addComponentDescriptions(
 		vector<VkVertexInputBindingDescription> *bindingDescs,
 		vector<VkVertexInputAttributeDescription> *attribDescs) {
@@ -78,180 +673,3249 @@ namespace particles {
 		graphics::init(window, bindingDescs, attribDescs);
 	}
 
-	void init(SDL_Window *window) {
-		
-		updateStartSemaphore = CreateSemaphore(NULL, 0, INT32_MAX, "particle_update_start");
-		SDL_assert(updateStartSemaphore);
+	uint32_t roundUpToWidestVector(uint32_t count) {
+		return (count + simd::maxWidth - 1) / simd::maxWidth * simd::maxWidth;
+	}
 
-		updateEndSemaphore = CreateSemaphore(NULL, 0, INT32_MAX, "particle_update_end");
-		SDL_assert(updateEndSemaphore);
+	// An emitter and the range of particles it owns.
+	struct EmitterRange {
+		Emitter emitter;
+		uint32_t firstParticle; // A multiple of simd::maxWidth, so that no vector holds the particles of two emitters
+		uint32_t firstChunk;
+		uint32_t chunkCount;
+		double spawnsOwed; // The fraction of a particle carried over from the previous step
+	};
 
-		setupGraphicsDescriptions(window);
+	vector<EmitterRange> emitterRanges;
 
-		renderableParticles = new Particle[particleCount];
+	// Each emitter's range is divided into chunks, the units of work given to the updater threads. A chunk keeps its live
+	// particles dense at its front, so only they are updated and drawn, and the rest of the chunk is its dead list:
+	// free slots its emitter spawns into.
+	const uint32_t particlesPerChunk = 1024;
 
-		uint32_t renderableFloatsPerParticle = 4; // x, y, z, brightness
-		uint32_t totalRenderableFloats = renderableFloatsPerParticle * particleCount;
-		
-		// The number of particles must fit into a multiple of __m256 without overlap,
-		// otherwise more complexity is required in the hot code path.
-		SDL_assert_release(totalRenderableFloats % floatsPerM256 == 0);
-		SDL_assert_release(particleCount % floatsPerM256 == 0);
-		m256Count = particleCount / floatsPerM256;
-			
-		positionsX.resize(m256Count);
-		positionsX.shrink_to_fit();
-		positionsY.resize(m256Count);
-		positionsY.shrink_to_fit();
-		positionsZ.resize(m256Count);
-		positionsZ.shrink_to_fit();
-		brightnesses.resize(m256Count);
-		brightnesses.shrink_to_fit();
-
-		velocitiesX.resize(m256Count);
-		velocitiesX.shrink_to_fit();
-		velocitiesY.resize(m256Count);
-		velocitiesY.shrink_to_fit();
-		velocitiesZ.resize(m256Count);
-		velocitiesZ.shrink_to_fit();
-
-		// Initial state
-		for (auto &x : positionsX) x = _mm256_set1_ps(1.1f);
-		for (uint32_t i = 0; i < particleCount; i++) M256s_TO_FLOATS(positionsY)[i] = 0.8f - (i / (float)particleCount) * 7;
-		for (auto &z : positionsZ) z = _mm256_set1_ps(0.0f);
-		for (auto &x : velocitiesX) x = _mm256_set1_ps(0.0f);
-		for (auto &y : velocitiesY) y = _mm256_set1_ps(0.0f);
-		for (auto &z : velocitiesZ) z = _mm256_set1_ps(0.0f);
-
-		const uint32_t threadCount = thread::hardware_concurrency();
-
-		uint32_t rangeSum = 0;
-
-		for (uint32_t i = 0; i < threadCount; i++) {
-			uint32_t rangeStartIndex = (i * m256Count) / threadCount; // This will round down
-			uint32_t rangeEndIndexExclusive = ((i + 1) * m256Count) / threadCount; // This will round down
-			updaterThreads.push_back(thread(updaterThread, rangeStartIndex, rangeEndIndexExclusive));
-			rangeSum += rangeEndIndexExclusive - rangeStartIndex;
-		}
-
-		SDL_assert_release(rangeSum == m256Count);
-	}
-
-	const float gravity = 1.0f;
-	const float airResistance = 0.1f;
-	const float groundLevel = 1.0f;
-	vec3 respawnPosition = { -0.8, -0.1, 0.95 };
-	float stepSize = 0.0f;
+	struct Chunk {
+		uint32_t firstParticle; // A multiple of simd::maxWidth
+		uint32_t size;
+		uint32_t liveCount;
+		uint32_t emitterIndex;
+		uint32_t spawnCount; // Particles to spawn into the chunk in this step, set by prepareStep()
+
+		// The update-rate LOD's tier: the chunk is updated every stepInterval steps, which is 1, 2, 4 or maxStepInterval.
+		uint32_t stepInterval;
+		bool stepping; // Whether the chunk is updated in this step, set by prepareStep()
+		float stepTime; // Real seconds the chunk advances by when it is updated: this step and those it skipped
+		float skippedTime; // Real seconds of the steps the chunk has skipped since it was last updated
+	};
+
+	vector<Chunk> chunks;
+
+	// The number of live and spawning particles in the chunks before each chunk, for dividing them between threads.
+	// Has one more entry than chunks, holding the total.
+	vector<uint64_t> chunkWorkStarts;
+
+	// An emitter's values as spawnRangeWith() needs them, set up by prepareStep() for each emitter.
+	struct SpawnValues {
+		vec3 position;
+		vec3 velocity;
+
+		// Perpendicular to the velocity and to each other, with the length of the cone's radius at the end of the velocity.
+		vec3 coneTangent;
+		vec3 coneBitangent;
 
-	void getRandomsForRespawn(__m256 &brightnesses, __m256 &velX, __m256 &velY, __m256 &velZ) {
-		float bufferA[floatsPerM256];
-		float bufferB[floatsPerM256];
-		float bufferC[floatsPerM256];
+		float lifetime;
+	};
 
-		for (int i = 0; i < floatsPerM256; i++) bufferA[i] = randf();
-		brightnesses = _mm256_load_ps(bufferA);
+	vector<SpawnValues> emitterSpawnValues;
 
-		vec3 baseVelocity = { 0.4, -1, -0.1 };
-		const float velocityRandomnessAmount = 0.3f;
+	// The state whose values placeState() copies into the new state, or nullptr to zero it, and its capacity.
+	const uint8_t *placementSource = nullptr;
+	uint32_t placementSourceCapacity = 0;
 
-		for (int i = 0; i < floatsPerM256; i++) {
-			vec3 velocityRandomness = { randf() - 0.5f, randf() - 0.5f, randf() - 0.5 };
-			velocityRandomness = normalize(velocityRandomness) * velocityRandomnessAmount * (randf()*0.95f + 0.05f);
-			vec3 velocity = baseVelocity + velocityRandomness;
+	// Whether the state's pages have been touched, by placeState() or, on the calling thread, by the steps themselves.
+	bool stateIsPlaced = false;
 
-			bufferA[i] = velocity.x;
-			bufferB[i] = velocity.y;
-			bufferC[i] = velocity.z;
+	void runUpdaterPass(UpdaterPass pass);
+
+	// The particles whose pages thread threadIndex of threadCount first touches: an even share of the capacity in whole
+	// chunks, which is the range findUpdateRange() gives it while every chunk is full.
+	void findHomeRange(uint32_t threadIndex, uint32_t threadCount, uint32_t *first, uint32_t *endExclusive) {
+		uint32_t chunkCount = (particleCapacity + particlesPerChunk - 1) / particlesPerChunk;
+		uint32_t firstParticle = (uint32_t)((uint64_t)threadIndex * chunkCount / threadCount) * particlesPerChunk;
+		uint32_t endParticle = (uint32_t)((uint64_t)(threadIndex + 1) * chunkCount / threadCount) * particlesPerChunk;
+		*first = firstParticle < particleCapacity ? firstParticle : particleCapacity;
+		*endExclusive = endParticle < particleCapacity ? endParticle : particleCapacity;
+	}
+
+	// Copies the particles [first, endExclusive) from placementSource and zeroes the rest of them, which touches their
+	// pages on the calling thread. An AoSoA block doesn't depend on the capacity, so the blocks are copied as they are.
+	// In SoA each attribute array is separately moved to its new offset.
+	void placeStateRange(uint32_t first, uint32_t endExclusive) {
+		uint32_t copyEnd = placementSourceCapacity < endExclusive ? placementSourceCapacity : endExclusive;
+		if (copyEnd < first) copyEnd = first;
+
+		// Offsets into the state and placementSource of values of size bytes for particle first.
+		auto place = [&](size_t destinationOffset, size_t sourceOffset, uint32_t size) {
+			if (copyEnd > first) memcpy(state + destinationOffset, placementSource + sourceOffset, (size_t)(copyEnd - first) * size);
+			memset(state + destinationOffset + (size_t)(copyEnd - first) * size, 0, (size_t)(endExclusive - copyEnd) * size);
+		};
+
+		if (layout == ParticleLayout::soa) {
+			for (int a = 0; a < attributeCount; a++) {
+				size_t offset = attributeOffset((Attribute)a);
+				uint32_t size = attributeSize((Attribute)a);
+				place(offset * particleCapacity + (size_t)first * size, offset * placementSourceCapacity + (size_t)first * size, size);
+			}
 		}
+		else place((size_t)first * bytesPerParticle(), (size_t)first * bytesPerParticle(), bytesPerParticle());
+	}
 
-		velX = _mm256_load_ps(bufferA);
-		velY = _mm256_load_ps(bufferB);
-		velZ = _mm256_load_ps(bufferC);
+	void placeStatePass(uint32_t threadIndex, uint32_t threadCount) {
+		uint32_t first, endExclusive;
+		findHomeRange(threadIndex, threadCount, &first, &endExclusive);
+		placeStateRange(first, endExclusive);
 	}
 
-	void respawnParticleVectorAtIndex(uint32_t m256Index) {
-		positionsX[m256Index] = _mm256_set1_ps(respawnPosition.x);
-		positionsY[m256Index] = _mm256_set1_ps(respawnPosition.y);
-		positionsZ[m256Index] = _mm256_set1_ps(respawnPosition.z);
-		getRandomsForRespawn(brightnesses[m256Index], velocitiesX[m256Index], velocitiesY[m256Index], velocitiesZ[m256Index]);
+	// Fills the newly allocated state from source, or with zeroes, on the updater threads with NUMA placement and on the
+	// calling thread without. New storage is zeroed, as masked lanes beyond the live particles are still computed on and
+	// mustn't be denormals.
+	void placeState(const uint8_t *source, uint32_t sourceCapacity) {
+		placementSource = source;
+		placementSourceCapacity = source ? sourceCapacity : 0;
+
+		if (enableNumaPlacement && steppingThreadCount > 1) runUpdaterPass(placeStatePass);
+		else placeStateRange(0, particleCapacity);
+
+		placementSource = nullptr;
+		placementSourceCapacity = 0;
+		stateIsPlaced = true;
 	}
 
-	void updateRange(uint32_t startIndex, uint32_t endIndexExclusive) {
+	// The number of particles can change between updates as emitters are added and their budgets change.
+	// Storage grows by doubling, so repeatedly growing and shrinking the count doesn't reallocate every time.
+	void setParticleCount(uint32_t newParticleCount) {
+		if (newParticleCount > particleCapacity) {
+			uint32_t newCapacity = particleCapacity * 2;
+			if (newCapacity < newParticleCount) newCapacity = roundUpToWidestVector(newParticleCount);
+
+			uint8_t *oldState = state;
+			size_t oldStateBytes = stateBytes;
+			uint32_t oldCapacity = particleCapacity;
+
+			stateBytes = (size_t)bytesPerParticle() * newCapacity;
+			state = allocatePages(stateBytes);
+			particleCapacity = newCapacity;
 
-		__m256 stepSizeVector = _mm256_set1_ps(stepSize);
-		__m256 velocityMultiplierVector = _mm256_set1_ps(1 - stepSize * airResistance);
-		__m256 gravityStepVector = _mm256_set1_ps(gravity * stepSize);
-		__m256 groundLevelVector = _mm256_set1_ps(groundLevel);
-		__m256 zeroVector = _mm256_set1_ps(0);
+			placeState(oldState, oldCapacity);
+			freePages(oldState, oldStateBytes);
+		}
 
-		for (uint32_t i = startIndex; i < endIndexExclusive; i++) {
-			velocitiesX[i] = _mm256_mul_ps(velocitiesX[i], velocityMultiplierVector);
-			positionsX[i] = _mm256_add_ps(positionsX[i], _mm256_mul_ps(velocitiesX[i], stepSizeVector));
+		particleCount = newParticleCount;
+		gridIsCurrent = false;
 
-			velocitiesY[i] = _mm256_add_ps(_mm256_mul_ps(velocitiesY[i], velocityMultiplierVector), gravityStepVector);
-			positionsY[i] = _mm256_add_ps(positionsY[i], _mm256_mul_ps(velocitiesY[i], stepSizeVector));
+		// The working set has changed size, so the memory access may need to change too.
+		selectUpdateRangeFunction(simdLevel);
+	}
 
-			velocitiesZ[i] = _mm256_mul_ps(velocitiesZ[i], velocityMultiplierVector);
-			positionsZ[i] = _mm256_add_ps(positionsZ[i], _mm256_mul_ps(velocitiesZ[i], stepSizeVector));
+	// Copies count particles from sourceFirst in source to destinationFirst in destination, states of the current layout
+	// with the given capacities. Both firsts are multiples of simd::maxWidth, so in AoSoA whole blocks are copied.
+	void copyParticles(uint8_t *destination, uint32_t destinationCapacity, uint32_t destinationFirst,
+		const uint8_t *source, uint32_t sourceCapacity, uint32_t sourceFirst, uint32_t count) {
 
-			// If all particles in the __m256 are below groundLevel (_CMP_LE_OQ == false), respawn them
-			__m256 comparisonResult = _mm256_cmp_ps(positionsY[i], groundLevelVector, _CMP_LE_OQ);
-			
-			if (memcmp(&comparisonResult, &zeroVector, sizeof(comparisonResult)) == 0) {
-				respawnParticleVectorAtIndex(i);
+		if (layout == ParticleLayout::soa) {
+			for (int a = 0; a < attributeCount; a++) {
+				size_t offset = attributeOffset((Attribute)a);
+				uint32_t size = attributeSize((Attribute)a);
+				memcpy(destination + offset * destinationCapacity + (size_t)destinationFirst * size,
+					source + offset * sourceCapacity + (size_t)sourceFirst * size, (size_t)count * size);
 			}
 		}
+		else {
+			uint32_t blockSize = blockSizeOfLayout(layout);
+			uint32_t blockCount = (count + blockSize - 1) / blockSize;
+			memcpy(destination + (size_t)destinationFirst * bytesPerParticle(), source + (size_t)sourceFirst * bytesPerParticle(),
+				(size_t)blockCount * blockSize * bytesPerParticle());
+		}
 	}
 
-	void updaterThread(uint32_t startIndex, uint32_t endIndexExclusive) {
-		while (!updaterThreadsShouldReturn) {
-			WaitForSingleObject(updateStartSemaphore, INFINITE);
+	// Places each emitter's range after the previous one's, starting from firstMovedEmitter, and divides the ranges into
+	// chunks. The emitters from there on may have moved or changed size. Each keeps the live particles of the chunks
+	// that still fit in its range, which are set aside while the ranges move.
+	void layOutEmitterRanges(uint32_t firstMovedEmitter) {
+		uint32_t endParticle = 0;
+		uint32_t endChunk = 0;
+
+		if (firstMovedEmitter > 0) {
+			const EmitterRange &previous = emitterRanges[firstMovedEmitter - 1];
+			endParticle = previous.firstParticle + previous.emitter.budget;
+			endChunk = previous.firstChunk + previous.chunkCount;
+		}
 
-			updateRange(startIndex, endIndexExclusive);
+		// The moved chunks, each with where its live particles are set aside
+		vector<Chunk> movedChunks(chunks.begin() + endChunk, chunks.end());
+		vector<uint32_t> asideFirsts(movedChunks.size());
+		uint32_t asideCapacity = 0;
 
-			ReleaseSemaphore(updateEndSemaphore, 1, nullptr);
+		for (size_t c = 0; c < movedChunks.size(); c++) {
+			asideFirsts[c] = asideCapacity;
+			asideCapacity += roundUpToWidestVector(movedChunks[c].liveCount);
 		}
-	}
 
-	void update(int particleCount, float deltaTime) {
-		static double totalTime = 0.0;
+		vector<uint8_t> aside((size_t)asideCapacity * bytesPerParticle());
+		for (size_t c = 0; c < movedChunks.size(); c++) {
+			copyParticles(aside.data(), asideCapacity, asideFirsts[c], state, particleCapacity, movedChunks[c].firstParticle, movedChunks[c].liveCount);
+		}
+
+		// The moved emitters' first chunks before they moved, or none for an emitter just added
+		vector<uint32_t> oldFirstChunks, oldChunkCounts;
+		for (uint32_t e = firstMovedEmitter; e < emitterRanges.size(); e++) {
+			bool laidOut = emitterRanges[e].chunkCount > 0;
+			oldFirstChunks.push_back(laidOut ? emitterRanges[e].firstChunk - endChunk : 0);
+			oldChunkCounts.push_back(laidOut ? emitterRanges[e].chunkCount : 0);
+		}
+
+		chunks.resize(endChunk);
+
+		for (uint32_t e = firstMovedEmitter; e < emitterRanges.size(); e++) {
+			EmitterRange &range = emitterRanges[e];
+			range.firstParticle = roundUpToWidestVector(endParticle);
+			range.firstChunk = (uint32_t)chunks.size();
+
+			for (uint32_t offset = 0; offset < range.emitter.budget; offset += particlesPerChunk) {
+				uint32_t chunkIndex = offset / particlesPerChunk;
 
-		// Update the stepSize for updateOneParticle()
-		stepSize = deltaTime * 0.5f;
+				Chunk chunk = {};
+				chunk.stepInterval = 1;
+				if (chunkIndex < oldChunkCounts[e - firstMovedEmitter]) chunk = movedChunks[oldFirstChunks[e - firstMovedEmitter] + chunkIndex];
 
-		// Move the respawn position for respawn()
-		totalTime += deltaTime;
-		respawnPosition.x = -0.8f + sinf((float)totalTime)*0.1f;
+				chunk.firstParticle = range.firstParticle + offset;
+				chunk.size = range.emitter.budget - offset < particlesPerChunk ? range.emitter.budget - offset : particlesPerChunk;
+				chunk.emitterIndex = e;
+				if (chunk.liveCount > chunk.size) chunk.liveCount = chunk.size;
+				chunks.push_back(chunk);
+			}
+
+			range.chunkCount = (uint32_t)chunks.size() - range.firstChunk;
+			endParticle = range.firstParticle + range.emitter.budget;
+		}
+
+		setParticleCount(endParticle);
 
-		// Notify the updater threads that updating should begin
-		ReleaseSemaphore(updateStartSemaphore, (LONG)updaterThreads.size(), nullptr);
+		for (uint32_t e = firstMovedEmitter; e < emitterRanges.size(); e++) {
+			const EmitterRange &range = emitterRanges[e];
+			uint32_t keptChunkCount = range.chunkCount < oldChunkCounts[e - firstMovedEmitter] ? range.chunkCount : oldChunkCounts[e - firstMovedEmitter];
 
-		// Wait until the updater threads are done
-		for (int i = 0; i < updaterThreads.size(); i++) {
-			WaitForSingleObject(updateEndSemaphore, INFINITE);
+			for (uint32_t c = 0; c < keptChunkCount; c++) {
+				const Chunk &chunk = chunks[range.firstChunk + c];
+				copyParticles(state, particleCapacity, chunk.firstParticle, aside.data(), asideCapacity, asideFirsts[oldFirstChunks[e - firstMovedEmitter] + c], chunk.liveCount);
+			}
 		}
 	}
 
-	void render() {
-		int componentCount = 4; // x, y, z, brightness
-		float * componentPtrs[] = {
-			(float*)positionsX.data(),
-			(float*)positionsY.data(),
-			(float*)positionsZ.data(),
-			(float*)brightnesses.data()
-		};
-		
-		graphics::render(particleCount, componentCount, componentPtrs);
+	// Kills every particle, so that each emitter starts again from an empty range.
+	void restartEmitters() {
+		for (auto &chunk : chunks) {
+			chunk.liveCount = 0;
+			chunk.skippedTime = 0.0f;
+		}
+
+		for (auto &range : emitterRanges) range.spawnsOwed = 0.0;
 	}
 
-	void destroy() {
+	const float defaultEmitterLifetime = 6.0f;
+
+	Emitter defaultEmitter(uint32_t budget) {
+		Emitter emitter;
+		emitter.position = { -0.8f, -0.1f, 0.95f };
+		emitter.velocity = { 0.4f, -1.0f, -0.1f };
+		emitter.coneAngle = 0.27f;
+		emitter.rate = budget / defaultEmitterLifetime;
+		emitter.lifetime = defaultEmitterLifetime;
+		emitter.budget = budget;
+		return emitter;
+	}
+
+	uint32_t addEmitter(const Emitter &emitter) {
+		EmitterRange range = {};
+		range.emitter = emitter;
+		emitterRanges.push_back(range);
+
+		layOutEmitterRanges((uint32_t)emitterRanges.size() - 1);
+		return (uint32_t)emitterRanges.size() - 1;
+	}
+
+	void setEmitter(uint32_t emitterIndex, const Emitter &emitter) {
+		SDL_assert_release(emitterIndex < emitterRanges.size());
+
+		bool budgetChanged = emitter.budget != emitterRanges[emitterIndex].emitter.budget;
+		emitterRanges[emitterIndex].emitter = emitter;
+		if (budgetChanged) layOutEmitterRanges(emitterIndex);
+	}
+
+	Emitter getEmitter(uint32_t emitterIndex) {
+		SDL_assert_release(emitterIndex < emitterRanges.size());
+		return emitterRanges[emitterIndex].emitter;
+	}
+
+	uint32_t getEmitterCount() {
+		return (uint32_t)emitterRanges.size();
+	}
+
+	void removeAllEmitters() {
+		emitterRanges.clear();
+		layOutEmitterRanges(0);
+	}
+
+	uint32_t getParticleCount() {
+		return particleCount;
+	}
+
+	uint32_t getLiveParticleCount() {
+		uint32_t liveCount = 0;
+		for (auto &chunk : chunks) liveCount += chunk.liveCount;
+		return liveCount;
+	}
+
+	void initSimulation(uint32_t newParticleCount, ParticleLayout newLayout, simd::Level newSimdLevel, StoragePrecision newPrecision) {
+		layout = newLayout;
+		precision = newPrecision;
+		simdLevel = newSimdLevel;
+
+		freePages(state, stateBytes);
+		particleCount = 0;
+		particleCapacity = roundUpToWidestVector(newParticleCount > 0 ? newParticleCount : 1);
+		stateBytes = (size_t)bytesPerParticle() * particleCapacity;
+		state = allocatePages(stateBytes);
+
+		// Without the updater threads, the state is left untouched until they start, or until the steps touch it.
+		if (enableNumaPlacement && steppingThreadCount <= 1) stateIsPlaced = false;
+		else placeState(nullptr, 0);
+
+		emitterRanges.clear();
+		addEmitter(defaultEmitter(newParticleCount));
+
+		stepIndex = 0;
+		simulatedTime = 0.0;
+		elapsedTime = 0.0;
+		unsimulatedTime = 0.0;
+
+		if (!replayUpdateRateLod) updateRateLodChanges.assign(1, { 0, updateRateLod });
+		replayedLodChanges = 0;
+	}
+
+	void startUpdaterThreads(uint32_t threadCount) {
+		updaterThreadsShouldReturn = false;
+		if (threadCount == 0) threadCount = 1;
+		steppingThreadCount = threadCount;
+
+		// The updater threads and the thread stepping them. Thread 0 has no wake latency, so its entry stays empty.
+		resetBarrier(updaterBarrier, threadCount);
+		steppingThreadSense = 0;
+		updaterWakeLatencies.assign(threadCount, WakeLatencies());
+		updateThreadNodes.assign(threadCount, 0);
+
+		if (enableNumaPlacement && threadCount > 1) pinSteppingThread(threadCount);
+
+		for (uint32_t i = 1; i < threadCount; i++) {
+			updaterThreads.push_back(thread(updaterThread, i));
+		}
+
+		if (!stateIsPlaced) placeState(nullptr, 0);
+	}
+
+	void stopUpdaterThreads() {
+		if (steppingThreadCount == 0) return;
+
+		// Releases the updater threads from the barrier before the next pass, where they see that they should return
 		updaterThreadsShouldReturn = true;
-		ReleaseSemaphore(updateStartSemaphore, (LONG)updaterThreads.size(), nullptr);
+		arriveAtBarrier(updaterBarrier, steppingThreadSense);
 
 		for (auto &thr : updaterThreads) thr.join();
+		updaterThreads.clear();
+		steppingThreadCount = 0;
+
+		unpinSteppingThread();
+	}
+
+	void startSimulation();
+
+	void init(SDL_Window *window) {
+		setupGraphicsDescriptions(window);
+
+		renderableParticles = new Particle[particleCount];
+
+		initSimulation(particleCount, defaultLayout, simd::detectLevel(), defaultPrecision);
+		printf("\nUpdating particles with %s\n", simd::levelName(simdLevel));
+
+		startSimulation();
+	}
+
+	// Loads and stores an attribute of Simd::width particles, converting it if the layout stores it as half floats.
+	template<typename Simd, typename Layout>
+	typename Simd::Float loadAttribute(const uint8_t *address, Attribute attribute) {
+		if (Layout::Precision::size(attribute) == sizeof(uint16_t)) return Simd::loadHalf((const uint16_t*)address);
+		return Simd::load((const float*)address);
+	}
+
+	template<typename Simd, typename Layout>
+	void storeAttribute(uint8_t *address, Attribute attribute, const typename Simd::Float &value) {
+		if (Layout::Precision::size(attribute) == sizeof(uint16_t)) Simd::storeHalf((uint16_t*)address, value);
+		else Simd::store((float*)address, value);
+	}
+
+	// The memory access strategies updateRange() can be compiled with. Caching is best while the particles fit in the
+	// last level cache. Beyond that each step streams them all from DRAM, and prefetching keeps more requests in flight.
+	struct CachedAccess {
+		static const bool prefetch = false;
+	};
+
+	struct PrefetchedAccess {
+		static const bool prefetch = true;
+	};
+
+	// Overwrites the particles from startParticle to endParticleExclusive with fresh ones from an emitter. The range
+	// needn't start or end on a vector boundary, so fresh values are generated for whole vectors and blended into the spawning lanes.
+	// The age attribute is set to initialAge, which is the spawn time in analytic mode.
+	template<typename Simd, typename Layout>
+	void spawnRangeWith(const SpawnValues &emitter, RandomGenerator<Simd> &rng, uint32_t startParticle, uint32_t endParticleExclusive, float initialAge = 0.0f) {
+		typedef typename Simd::Float Float;
+		typedef typename Simd::Mask Mask;
+
+		const Float half = Simd::set(0.5f);
+
+		for (uint32_t i = startParticle - startParticle % Simd::width; i < endParticleExclusive; i += Simd::width) {
+			Mask spawning = Simd::firstLanes(endParticleExclusive - i);
+			if (i < startParticle) spawning = Simd::andNotMask(spawning, Simd::firstLanes(startParticle - i));
+
+			// A random point in the disc at the end of the velocity: a random direction, not quite uniformly distributed,
+			// at a random radius. sqrt and div are used instead of rsqrt because rsqrt's precision differs between CPUs,
+			// which would make runs irreproducible across machines.
+			Float discX = Simd::sub(rng.nextFloats(i, 1), half);
+			Float discY = Simd::sub(rng.nextFloats(i, 2), half);
+			Float lengthSquared = Simd::maximum(Simd::mulAdd(discX, discX, Simd::mul(discY, discY)), Simd::set(1e-12f));
+			Float scale = Simd::sqrt(Simd::div(rng.nextFloats(i, 3), lengthSquared));
+			discX = Simd::mul(discX, scale);
+			discY = Simd::mul(discY, scale);
+
+			Float values[attributeCount];
+			values[positionX] = Simd::set(emitter.position.x);
+			values[positionY] = Simd::set(emitter.position.y);
+			values[positionZ] = Simd::set(emitter.position.z);
+			values[age] = Simd::set(initialAge);
+			values[velocityX] = Simd::mulAdd(discX, Simd::set(emitter.coneTangent.x), Simd::mulAdd(discY, Simd::set(emitter.coneBitangent.x), Simd::set(emitter.velocity.x)));
+			values[velocityY] = Simd::mulAdd(discX, Simd::set(emitter.coneTangent.y), Simd::mulAdd(discY, Simd::set(emitter.coneBitangent.y), Simd::set(emitter.velocity.y)));
+			values[velocityZ] = Simd::mulAdd(discX, Simd::set(emitter.coneTangent.z), Simd::mulAdd(discY, Simd::set(emitter.coneBitangent.z), Simd::set(emitter.velocity.z)));
+			values[lifetime] = Simd::set(emitter.lifetime);
+			values[brightness] = rng.nextFloats(i, 0);
+
+			for (int a = 0; a < attributeCount; a++) {
+				uint8_t *address = Layout::find(state, particleCapacity, (Attribute)a, i);
+				Float oldValues = loadAttribute<Simd, Layout>(address, (Attribute)a);
+				storeAttribute<Simd, Layout>(address, (Attribute)a, Simd::blend(oldValues, values[a], spawning));
+			}
+		}
+	}
+
+	// The forces are composed at compile time into a ForceList, which updateRange() applies to each vector of particles
+	// while it has their positions and velocities in registers. Adding a force adds arithmetic to the kernel but no pass
+	// over memory. Each force type has a Vectors struct, which broadcasts its settings once per range, and adds the
+	// force's acceleration to the vectors of particles.
+	template<typename Simd>
+	struct Motion {
+		typename Simd::Float posX, posY, posZ;
+		typename Simd::Float velX, velY, velZ;
+		uint32_t firstParticle; // The index of the particle in the first lane, for forces that look up per-particle values
+	};
+
+	template<typename Simd>
+	struct Acceleration {
+		typename Simd::Float x, y, z;
+	};
+
+	struct Gravity {
+		template<typename Simd>
+		struct Vectors {
+			typename Simd::Float x, y, z;
+
+			Vectors() : x(Simd::set(forceSettings.gravity.x)), y(Simd::set(forceSettings.gravity.y)), z(Simd::set(forceSettings.gravity.z)) {}
+
+			void accelerate(const Motion<Simd> &, Acceleration<Simd> &acceleration) const {
+				acceleration.x = Simd::add(acceleration.x, x);
+				acceleration.y = Simd::add(acceleration.y, y);
+				acceleration.z = Simd::add(acceleration.z, z);
+			}
+		};
+	};
+
+	struct LinearDrag {
+		template<typename Simd>
+		struct Vectors {
+			typename Simd::Float negativeDrag;
+
+			Vectors() : negativeDrag(Simd::set(-forceSettings.linearDrag)) {}
+
+			void accelerate(const Motion<Simd> &particles, Acceleration<Simd> &acceleration) const {
+				acceleration.x = Simd::mulAdd(particles.velX, negativeDrag, acceleration.x);
+				acceleration.y = Simd::mulAdd(particles.velY, negativeDrag, acceleration.y);
+				acceleration.z = Simd::mulAdd(particles.velZ, negativeDrag, acceleration.z);
+			}
+		};
+	};
+
+	struct QuadraticDrag {
+		template<typename Simd>
+		struct Vectors {
+			typename Simd::Float negativeDrag;
+
+			Vectors() : negativeDrag(Simd::set(-forceSettings.quadraticDrag)) {}
+
+			void accelerate(const Motion<Simd> &particles, Acceleration<Simd> &acceleration) const {
+				typename Simd::Float speedSquared = Simd::mulAdd(particles.velX, particles.velX,
+					Simd::mulAdd(particles.velY, particles.velY, Simd::mul(particles.velZ, particles.velZ)));
+				typename Simd::Float scale = Simd::mul(Simd::sqrt(speedSquared), negativeDrag);
+
+				acceleration.x = Simd::mulAdd(particles.velX, scale, acceleration.x);
+				acceleration.y = Simd::mulAdd(particles.velY, scale, acceleration.y);
+				acceleration.z = Simd::mulAdd(particles.velZ, scale, acceleration.z);
+			}
+		};
+	};
+
+	// Pulls towards forceSettings.attractors[index] with an inverse square falloff.
+	template<int index>
+	struct PointAttractor {
+		template<typename Simd>
+		struct Vectors {
+			typename Simd::Float x, y, z, strength, softeningSquared;
+
+			Vectors() {
+				const Attractor &attractor = forceSettings.attractors[index];
+				x = Simd::set(attractor.position.x);
+				y = Simd::set(attractor.position.y);
+				z = Simd::set(attractor.position.z);
+				strength = Simd::set(attractor.strength);
+				softeningSquared = Simd::set(attractor.softening * attractor.softening);
+			}
+
+			void accelerate(const Motion<Simd> &particles, Acceleration<Simd> &acceleration) const {
+				typename Simd::Float dx = Simd::sub(x, particles.posX);
+				typename Simd::Float dy = Simd::sub(y, particles.posY);
+				typename Simd::Float dz = Simd::sub(z, particles.posZ);
+
+				typename Simd::Float distanceSquared = Simd::mulAdd(dx, dx, Simd::mulAdd(dy, dy, Simd::mulAdd(dz, dz, softeningSquared)));
+				typename Simd::Float scale = Simd::div(strength, Simd::mul(distanceSquared, Simd::sqrt(distanceSquared)));
+
+				acceleration.x = Simd::mulAdd(dx, scale, acceleration.x);
+				acceleration.y = Simd::mulAdd(dy, scale, acceleration.y);
+				acceleration.z = Simd::mulAdd(dz, scale, acceleration.z);
+			}
+		};
+	};
+
+	// Swirls particles around forceSettings.vortex's axis, more strongly nearer its center.
+	struct VortexForce {
+		template<typename Simd>
+		struct Vectors {
+			typename Simd::Float centerX, centerY, centerZ, axisX, axisY, axisZ, strength, softeningSquared;
+
+			Vectors() {
+				const Vortex &vortex = forceSettings.vortex;
+				centerX = Simd::set(vortex.center.x);
+				centerY = Simd::set(vortex.center.y);
+				centerZ = Simd::set(vortex.center.z);
+				axisX = Simd::set(vortex.axis.x);
+				axisY = Simd::set(vortex.axis.y);
+				axisZ = Simd::set(vortex.axis.z);
+				strength = Simd::set(vortex.strength);
+				softeningSquared = Simd::set(vortex.softening * vortex.softening);
+			}
+
+			void accelerate(const Motion<Simd> &particles, Acceleration<Simd> &acceleration) const {
+				typename Simd::Float dx = Simd::sub(particles.posX, centerX);
+				typename Simd::Float dy = Simd::sub(particles.posY, centerY);
+				typename Simd::Float dz = Simd::sub(particles.posZ, centerZ);
+
+				typename Simd::Float distanceSquared = Simd::mulAdd(dx, dx, Simd::mulAdd(dy, dy, Simd::mulAdd(dz, dz, softeningSquared)));
+				typename Simd::Float scale = Simd::div(strength, distanceSquared);
+
+				// The cross product of the axis and the offset from the center
+				acceleration.x = Simd::mulAdd(Simd::sub(Simd::mul(axisY, dz), Simd::mul(axisZ, dy)), scale, acceleration.x);
+				acceleration.y = Simd::mulAdd(Simd::sub(Simd::mul(axisZ, dx), Simd::mul(axisX, dz)), scale, acceleration.y);
+				acceleration.z = Simd::mulAdd(Simd::sub(Simd::mul(axisX, dy), Simd::mul(axisY, dx)), scale, acceleration.z);
+			}
+		};
+	};
+
+	// Drags particles towards forceSettings.wind's velocity.
+	struct WindForce {
+		template<typename Simd>
+		struct Vectors {
+			typename Simd::Float x, y, z, negativeCoupling;
+
+			Vectors() {
+				const Wind &wind = forceSettings.wind;
+				x = Simd::set(wind.velocity.x * wind.coupling);
+				y = Simd::set(wind.velocity.y * wind.coupling);
+				z = Simd::set(wind.velocity.z * wind.coupling);
+				negativeCoupling = Simd::set(-wind.coupling);
+			}
+
+			void accelerate(const Motion<Simd> &particles, Acceleration<Simd> &acceleration) const {
+				acceleration.x = Simd::mulAdd(particles.velX, negativeCoupling, Simd::add(acceleration.x, x));
+				acceleration.y = Simd::mulAdd(particles.velY, negativeCoupling, Simd::add(acceleration.y, y));
+				acceleration.z = Simd::mulAdd(particles.velZ, negativeCoupling, Simd::add(acceleration.z, z));
+			}
+		};
+	};
+
+	// The turbulence's noise repeats every turbulenceNoisePeriod cells, which must be a power of two.
+	const uint32_t turbulenceNoisePeriod = 4096;
+
+	// Brings the curl of one octave of noise to a typical magnitude of about 1.
+	const float turbulenceNoiseScale = 25.0f;
+
+	// Each octave's noise is hashed with a different key, so that the octaves aren't scaled copies of each other.
+	const uint32_t turbulenceOctaveKeys[maxTurbulenceOctaves] = {
+		0x68E31DA4, 0xB5297A4D, 0x1B56C4E9, 0x7F4A7C15, 0xD2A98B26, 0x3C6EF372, 0xA54FF53A, 0x510E527F
+	};
+
+	// Accelerates particles along the curl of a vector field of three simplex noises, which has no divergence. The noises
+	// share their simplices and differ only in their gradients, so each octave finds its four simplex corners once. The
+	// gradients are hashed from the corners' coordinates rather than looked up in a permutation table, so there are no
+	// gathers, and the partial derivatives are analytic rather than from differences of extra noise samples.
+	struct CurlNoise {
+		template<typename Simd>
+		struct Vectors {
+			typedef typename Simd::Float Float;
+			typedef typename Simd::Int Int;
+
+			Float offsetX, offsetY, offsetZ, frequency, strength;
+			uint32_t octaves;
+
+			Vectors() {
+				const Turbulence &turbulence = forceSettings.turbulence;
+
+				// The noise moves with the drift, which is the same as the particles moving against it. The offset is
+				// wrapped to the noise's period, so that it keeps its precision however long the simulation runs.
+				double cellsMoved = simulatedTime * turbulence.frequency;
+				offsetX = Simd::set((float)fmod(-turbulence.drift.x * cellsMoved, turbulenceNoisePeriod));
+				offsetY = Simd::set((float)fmod(-turbulence.drift.y * cellsMoved, turbulenceNoisePeriod));
+				offsetZ = Simd::set((float)fmod(-turbulence.drift.z * cellsMoved, turbulenceNoisePeriod));
+				frequency = Simd::set(turbulence.frequency);
+				strength = Simd::set(turbulence.strength * turbulenceNoiseScale);
+				octaves = turbulence.octaves < maxTurbulenceOctaves ? turbulence.octaves : maxTurbulenceOctaves;
+			}
+
+			void accelerate(const Motion<Simd> &particles, Acceleration<Simd> &acceleration) const {
+				Float x = Simd::mulAdd(particles.posX, frequency, offsetX);
+				Float y = Simd::mulAdd(particles.posY, frequency, offsetY);
+				Float z = Simd::mulAdd(particles.posZ, frequency, offsetZ);
+				Float amplitude = strength;
+
+				for (uint32_t octave = 0; octave < octaves; octave++) {
+					Float curlX = Simd::set(0.0f), curlY = Simd::set(0.0f), curlZ = Simd::set(0.0f);
+					addCurl(x, y, z, turbulenceOctaveKeys[octave], curlX, curlY, curlZ);
+
+					acceleration.x = Simd::mulAdd(curlX, amplitude, acceleration.x);
+					acceleration.y = Simd::mulAdd(curlY, amplitude, acceleration.y);
+					acceleration.z = Simd::mulAdd(curlZ, amplitude, acceleration.z);
+
+					x = Simd::add(x, x);
+					y = Simd::add(y, y);
+					z = Simd::add(z, z);
+					amplitude = Simd::mul(amplitude, Simd::set(0.5f));
+				}
+			}
+
+
+			// Three gradients in the range -1 to 1, one for each of the noises, hashed from a simplex corner's lattice
+			// coordinates. The coordinates are wrapped to turbulenceNoisePeriod, so that the noise repeats with it.
+			static void hashGradients(const Float &cornerX, const Float &cornerY, const Float &cornerZ, uint32_t key,
+				Float gradients[3][3]) {
+
+				const Int periodMask = Simd::setInt(turbulenceNoisePeriod - 1);
+				Int bits = Simd::mulInt(Simd::andInt(Simd::truncateToInt(cornerX), periodMask), Simd::setInt(0x8DA6B343));
+				bits = Simd::xorInt(bits, Simd::mulInt(Simd::andInt(Simd::truncateToInt(cornerY), periodMask), Simd::setInt(0xD8163841)));
+				bits = Simd::xorInt(bits, Simd::mulInt(Simd::andInt(Simd::truncateToInt(cornerZ), periodMask), Simd::setInt(0xCB1AB31F)));
+				bits = Simd::xorInt(bits, Simd::setInt(key));
+
+				// The MurmurHash3 finalizer
+				bits = Simd::xorInt(bits, Simd::template shiftRight<16>(bits));
+				bits = Simd::mulInt(bits, Simd::setInt(0x85EBCA6B));
+				bits = Simd::xorInt(bits, Simd::template shiftRight<13>(bits));
+				bits = Simd::mulInt(bits, Simd::setInt(0xC2B2AE35));
+				bits = Simd::xorInt(bits, Simd::template shiftRight<16>(bits));
+
+				for (int noise = 0; noise < 3; noise++) {
+					// A multiply and shift is enough to decorrelate the other noises' bits from the well mixed first ones
+					if (noise > 0) {
+						bits = Simd::mulInt(bits, Simd::setInt(0x9E3779B9));
+						bits = Simd::xorInt(bits, Simd::template shiftRight<15>(bits));
+					}
+
+					// Each component comes from a different part of the bits. Gradients needn't be precise, and the
+					// last component's 10 bits are plenty.
+					gradients[noise][0] = Simd::signedUnitFloats(bits);
+					gradients[noise][1] = Simd::signedUnitFloats(Simd::template shiftLeft<11>(bits));
+					gradients[noise][2] = Simd::signedUnitFloats(Simd::template shiftLeft<22>(bits));
+				}
+			}
+
+			// Adds one simplex corner's contribution to the curl. Each noise's contribution is t^4 (g.d), where d is the
+			// offset from the corner and t = 0.5 - d.d, so its gradient is t^4 g - 8 t^3 (g.d) d.
+			static void addCorner(const Float &cornerX, const Float &cornerY, const Float &cornerZ, const Float &dx, const Float &dy,
+				const Float &dz, uint32_t key, Float &curlX, Float &curlY, Float &curlZ) {
+
+				Float t = Simd::maximum(Simd::sub(Simd::set(0.5f), Simd::mulAdd(dx, dx, Simd::mulAdd(dy, dy, Simd::mul(dz, dz)))), Simd::set(0.0f));
+				Float t2 = Simd::mul(t, t);
+				Float t4 = Simd::mul(t2, t2);
+				Float minus8t3 = Simd::mul(Simd::mul(t2, t), Simd::set(-8.0f));
+
+				Float g[3][3];
+				hashGradients(cornerX, cornerY, cornerZ, key, g);
+
+				Float dot0 = Simd::mulAdd(g[0][0], dx, Simd::mulAdd(g[0][1], dy, Simd::mul(g[0][2], dz)));
+				Float dot1 = Simd::mulAdd(g[1][0], dx, Simd::mulAdd(g[1][1], dy, Simd::mul(g[1][2], dz)));
+				Float dot2 = Simd::mulAdd(g[2][0], dx, Simd::mulAdd(g[2][1], dy, Simd::mul(g[2][2], dz)));
+
+				// The curl of the field (noise0, noise1, noise2) is (d2/dy - d1/dz, d0/dz - d2/dx, d1/dx - d0/dy).
+				curlX = Simd::mulAdd(t4, Simd::sub(g[2][1], g[1][2]), Simd::mulAdd(minus8t3, Simd::sub(Simd::mul(dot2, dy), Simd::mul(dot1, dz)), curlX));
+				curlY = Simd::mulAdd(t4, Simd::sub(g[0][2], g[2][0]), Simd::mulAdd(minus8t3, Simd::sub(Simd::mul(dot0, dz), Simd::mul(dot2, dx)), curlY));
+				curlZ = Simd::mulAdd(t4, Simd::sub(g[1][0], g[0][1]), Simd::mulAdd(minus8t3, Simd::sub(Simd::mul(dot1, dx), Simd::mul(dot0, dy)), curlZ));
+			}
+
+			static void addCurl(const Float &x, const Float &y, const Float &z, uint32_t key, Float &curlX, Float &curlY, Float &curlZ) {
+				const Float zero = Simd::set(0.0f);
+				const Float one = Simd::set(1.0f);
+				const float unskew = 1.0f / 6.0f;
+
+				// The corner of the skewed cube the point is in
+				Float skew = Simd::mul(Simd::add(x, Simd::add(y, z)), Simd::set(1.0f / 3.0f));
+				Float i = Simd::floor(Simd::add(x, skew));
+				Float j = Simd::floor(Simd::add(y, skew));
+				Float k = Simd::floor(Simd::add(z, skew));
+
+				Float unskewOffset = Simd::mul(Simd::add(i, Simd::add(j, k)), Simd::set(unskew));
+				Float dx0 = Simd::sub(x, Simd::sub(i, unskewOffset));
+				Float dy0 = Simd::sub(y, Simd::sub(j, unskewOffset));
+				Float dz0 = Simd::sub(z, Simd::sub(k, unskewOffset));
+
+				// Which of the cube's six simplices the point is in, from the order of dx0, dy0 and dz0. The comparisons
+				// are made 0 or 1 so that they can be combined without separate mask operations for each instruction set.
+				Float xy = Simd::blend(zero, one, Simd::greaterThan(dx0, dy0));
+				Float yz = Simd::blend(zero, one, Simd::greaterThan(dy0, dz0));
+				Float xz = Simd::blend(zero, one, Simd::greaterThan(dx0, dz0));
+				Float yx = Simd::sub(one, xy), zy = Simd::sub(one, yz), zx = Simd::sub(one, xz);
+
+				Float i1 = Simd::mul(xy, xz), j1 = Simd::mul(yx, yz), k1 = Simd::mul(zx, zy);
+				Float i2 = Simd::maximum(xy, xz), j2 = Simd::maximum(yx, yz), k2 = Simd::maximum(zx, zy);
+
+				addCorner(i, j, k, dx0, dy0, dz0, key, curlX, curlY, curlZ);
+
+				addCorner(Simd::add(i, i1), Simd::add(j, j1), Simd::add(k, k1),
+					Simd::add(Simd::sub(dx0, i1), Simd::set(unskew)),
+					Simd::add(Simd::sub(dy0, j1), Simd::set(unskew)),
+					Simd::add(Simd::sub(dz0, k1), Simd::set(unskew)), key, curlX, curlY, curlZ);
+
+				addCorner(Simd::add(i, i2), Simd::add(j, j2), Simd::add(k, k2),
+					Simd::add(Simd::sub(dx0, i2), Simd::set(2 * unskew)),
+					Simd::add(Simd::sub(dy0, j2), Simd::set(2 * unskew)),
+					Simd::add(Simd::sub(dz0, k2), Simd::set(2 * unskew)), key, curlX, curlY, curlZ);
+
+				addCorner(Simd::add(i, one), Simd::add(j, one), Simd::add(k, one),
+					Simd::add(dx0, Simd::set(3 * unskew - 1)),
+					Simd::add(dy0, Simd::set(3 * unskew - 1)),
+					Simd::add(dz0, Simd::set(3 * unskew - 1)), key, curlX, curlY, curlZ);
+			}
+		};
+	};
+
+	SimulationMode simulationMode = SimulationMode::ballistic;
+
+	// Water-like, but softer and more viscous than water so that the steps can stay long. The particles settle about
+	// 0.0126 apart, so each has about thirty neighbors within the smoothing length.
+	FluidSettings fluidSettings = {
+		1000.0f, // restDensity
+		0.002f, // particleMass
+		10.0f, // stiffness
+		2.0f, // viscosity
+		1.0f // joiningAge, long enough for the fountain's jet to have spread out
+	};
+
+	// The fluid passes' per-particle values. The positions, velocities, densities and pressures are arranged in the
+	// neighbor grid's order, so that each bucket's particles are contiguous and are read as vectors, and the
+	// accelerations by particle index, for updateRange(). Each array has simd::maxWidth floats of padding after it, so
+	// that the last bucket can be read a whole vector at a time.
+	enum FluidArray {
+		fluidPositionX, fluidPositionY, fluidPositionZ,
+		fluidVelocityX, fluidVelocityY, fluidVelocityZ,
+		fluidInverseDensity, fluidPressureRatio, // 1 / density and pressure / density
+		fluidAccelerationX, fluidAccelerationY, fluidAccelerationZ,
+		fluidArrayCount
+	};
+
+	float *fluidArrays[fluidArrayCount] = {};
+
+	// The fluid's pressure and viscosity, found for every particle by the fluid passes before updateRange() runs.
+	struct FluidForce {
+		template<typename Simd>
+		struct Vectors {
+			const float *x, *y, *z;
+
+			Vectors() : x(fluidArrays[fluidAccelerationX]), y(fluidArrays[fluidAccelerationY]), z(fluidArrays[fluidAccelerationZ]) {}
+
+			void accelerate(const Motion<Simd> &particles, Acceleration<Simd> &acceleration) const {
+				acceleration.x = Simd::add(acceleration.x, Simd::load(&x[particles.firstParticle]));
+				acceleration.y = Simd::add(acceleration.y, Simd::load(&y[particles.firstParticle]));
+				acceleration.z = Simd::add(acceleration.z, Simd::load(&z[particles.firstParticle]));
+			}
+		};
+	};
+
+	// Applies each force in the list in turn. The recursion is resolved at compile time and everything is inlined into the kernel.
+	template<typename... Forces>
+	struct ForceList;
+
+	template<>
+	struct ForceList<> {
+		template<typename Simd>
+		struct Vectors {
+			void accelerate(const Motion<Simd> &, Acceleration<Simd> &) const {}
+		};
+	};
+
+	template<typename First, typename... Rest>
+	struct ForceList<First, Rest...> {
+		template<typename Simd>
+		struct Vectors {
+			typename First::template Vectors<Simd> first;
+			typename ForceList<Rest...>::template Vectors<Simd> rest;
+
+			void accelerate(const Motion<Simd> &particles, Acceleration<Simd> &acceleration) const {
+				first.accelerate(particles, acceleration);
+				rest.accelerate(particles, acceleration);
+			}
+		};
+	};
+
+	// The forces the application simulates. Forces not in the list cost nothing.
+	typedef ForceList<Gravity, LinearDrag, CurlNoise> Forces;
+
+	// Every force type, so that benchmarks.cpp can measure what a full list costs.
+	typedef ForceList<Gravity, LinearDrag, QuadraticDrag, PointAttractor<0>, PointAttractor<1>, VortexForce, WindForce, CurlNoise> AllForces;
+	bool simulateAllForces = false;
+
+	// The forces in fluid mode. The fluid's own eddies take the place of the turbulence.
+	typedef ForceList<Gravity, LinearDrag, FluidForce> FluidForces;
+
+	Integrator integrator = Integrator::semiImplicitEuler;
+
+	template<typename Simd, typename ForceVectors>
+	Acceleration<Simd> findAcceleration(const ForceVectors &forces, const Motion<Simd> &particles) {
+		typename Simd::Float zero = Simd::set(0.0f);
+		Acceleration<Simd> acceleration = { zero, zero, zero };
+		forces.accelerate(particles, acceleration);
+		return acceleration;
+	}
+
+	// Every integrator is a case of one explicit scheme of up to two stages, chosen at run time, so that they share the
+	// update kernels rather than each compiling its own. The first stage's acceleration a0 is found at the start of the
+	// step, and a second stage's a1 at the probe (x0 + (v0 + r a0 h) p h, v0 + u a0 h). The step ends at
+	// x0 + (v0 + q a0 h) h and v0 + (w0 a0 + w1 a1) h. None of them keep anything between steps, so they all use the
+	// same particle attributes.
+	struct IntegratorScheme {
+		uint32_t stageCount;
+		float probeAcceleration, probeTime, probeVelocity; // r, p and u
+		float positionAcceleration; // q
+		float startWeight, endWeight; // w0 and w1
+	};
+
+	// In the order of Integrator.
+	const IntegratorScheme integratorSchemes[] = {
+		// Semi-implicit Euler: the velocities are updated first and the positions move with the new velocities. First
+		// order, but it keeps the energy of an orbit bounded.
+		{ 1, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f },
+		// Velocity Verlet: the positions move with the starting velocities and accelerations, and the velocities with the
+		// mean of the accelerations at the start and the end. The forces depend on the velocities, so the end's are found
+		// with the velocities the start's predict. The start's accelerations are the end's from the step before, but they
+		// are found again rather than kept, as keeping them would add three attributes to every step's memory traffic.
+		{ 2, 0.5f, 1.0f, 1.0f, 0.5f, 0.5f, 0.5f },
+		// Second-order Runge-Kutta: a half step of explicit Euler finds the midpoint, and the whole step is taken with the
+		// midpoint's velocities and accelerations.
+		{ 2, 0.0f, 0.5f, 0.5f, 0.5f, 0.0f, 1.0f }
+	};
+
+	// An IntegratorScheme's coefficients multiplied by a step size and broadcast.
+	template<typename Simd>
+	struct IntegratorVectors {
+		typedef typename Simd::Float Float;
+
+		uint32_t stageCount;
+		Float step, probeAcceleration, probeStep, probeVelocity, positionAcceleration, startWeight, endWeight;
+
+		IntegratorVectors(const IntegratorScheme &scheme, float duration) : stageCount(scheme.stageCount), step(Simd::set(duration)),
+			probeAcceleration(Simd::set(scheme.probeAcceleration * duration)), probeStep(Simd::set(scheme.probeTime * duration)),
+			probeVelocity(Simd::set(scheme.probeVelocity * duration)), positionAcceleration(Simd::set(scheme.positionAcceleration * duration)),
+			startWeight(Simd::set(scheme.startWeight * duration)), endWeight(Simd::set(scheme.endWeight * duration)) {}
+
+		template<typename ForceVectors>
+		Motion<Simd> advance(const Motion<Simd> &particles, const ForceVectors &forces) const {
+			// The stages share one call of the forces, so that they are inlined into the kernel once.
+			Acceleration<Simd> start = {}, end = {};
+			Motion<Simd> probe = particles;
+
+			for (uint32_t s = 0;; s++) {
+				Acceleration<Simd> acceleration = findAcceleration(forces, probe);
+				if (s > 0) end = acceleration;
+				else start = acceleration;
+				if (s + 1 >= stageCount) break;
+
+				probe.posX = Simd::mulAdd(Simd::mulAdd(start.x, probeAcceleration, particles.velX), probeStep, particles.posX);
+				probe.posY = Simd::mulAdd(Simd::mulAdd(start.y, probeAcceleration, particles.velY), probeStep, particles.posY);
+				probe.posZ = Simd::mulAdd(Simd::mulAdd(start.z, probeAcceleration, particles.velZ), probeStep, particles.posZ);
+				probe.velX = Simd::mulAdd(start.x, probeVelocity, particles.velX);
+				probe.velY = Simd::mulAdd(start.y, probeVelocity, particles.velY);
+				probe.velZ = Simd::mulAdd(start.z, probeVelocity, particles.velZ);
+			}
+
+			Motion<Simd> moved;
+			moved.firstParticle = particles.firstParticle;
+			moved.posX = Simd::mulAdd(Simd::mulAdd(start.x, positionAcceleration, particles.velX), step, particles.posX);
+			moved.posY = Simd::mulAdd(Simd::mulAdd(start.y, positionAcceleration, particles.velY), step, particles.posY);
+			moved.posZ = Simd::mulAdd(Simd::mulAdd(start.z, positionAcceleration, particles.velZ), step, particles.posZ);
+			moved.velX = Simd::mulAdd(start.x, startWeight, particles.velX);
+			moved.velY = Simd::mulAdd(start.y, startWeight, particles.velY);
+			moved.velZ = Simd::mulAdd(start.z, startWeight, particles.velZ);
+
+			if (stageCount > 1) {
+				moved.velX = Simd::mulAdd(end.x, endWeight, moved.velX);
+				moved.velY = Simd::mulAdd(end.y, endWeight, moved.velY);
+				moved.velZ = Simd::mulAdd(end.z, endWeight, moved.velZ);
+			}
+
+			return moved;
+		}
+	};
+
+	// A floor just above groundLevel, walled in at the edges of the view so that the fluid pools, with a sphere and a
+	// tilted box where the fountain comes down. Positive y is down.
+	ColliderSettings colliderSettings = {
+		{
+			{ vec3(0.0f, -1.0f, 0.0f), -0.9f, { 0.3f, 0.2f } },
+			{ vec3(1.0f, 0.0f, 0.0f), -1.0f, { 0.3f, 0.2f } },
+			{ vec3(-1.0f, 0.0f, 0.0f), -1.0f, { 0.3f, 0.2f } },
+			{ vec3(0.0f, 0.0f, 1.0f), 0.0f, { 0.3f, 0.2f } },
+			{ vec3(0.0f, 0.0f, -1.0f), -1.0f, { 0.3f, 0.2f } }
+		}, // planes
+		{ { vec3(0.15f, 0.45f, 0.85f), 0.12f, { 0.5f, 0.1f } } }, // spheres
+		{ { vec3(0.5f, 0.8f, 0.9f), { vec3(0.866f, 0.5f, 0.0f), vec3(-0.5f, 0.866f, 0.0f), vec3(0.0f, 0.0f, 1.0f) }, vec3(0.15f, 0.04f, 0.15f), { 0.4f, 0.3f } } } // boxes
+	};
+
+	// Colliders are composed at compile time into a ColliderList like the forces, and applied to each vector of particles
+	// after it has moved. Every particle is tested against every collider and the results are blended in with masks,
+	// so there are no branches.
+	template<typename Simd>
+	struct SurfaceVectors {
+		typename Simd::Float restitution, tangentialScale;
+
+		SurfaceVectors(const CollisionSurface &surface) : restitution(Simd::set(surface.restitution)), tangentialScale(Simd::set(1.0f - surface.friction)) {}
+	};
+
+	// Moves the particles in the colliding lanes depth along the outward normal, back to the surface. Those moving into
+	// the surface bounce, losing speed to the restitution and the friction.
+	template<typename Simd>
+	void resolveCollision(Motion<Simd> &particles, const typename Simd::Mask &colliding, const typename Simd::Float &overlap,
+		const typename Simd::Float &normalX, const typename Simd::Float &normalY, const typename Simd::Float &normalZ,
+		const SurfaceVectors<Simd> &surface) {
+
+		typedef typename Simd::Float Float;
+		const Float zero = Simd::set(0.0f);
+
+		const Float depth = Simd::blend(zero, overlap, colliding);
+		particles.posX = Simd::mulAdd(normalX, depth, particles.posX);
+		particles.posY = Simd::mulAdd(normalY, depth, particles.posY);
+		particles.posZ = Simd::mulAdd(normalZ, depth, particles.posZ);
+
+		// The velocity is split into its normal and tangential parts: v = vn n + vt, and becomes tangentialScale vt - restitution vn n
+		Float normalSpeed = Simd::mulAdd(particles.velX, normalX, Simd::mulAdd(particles.velY, normalY, Simd::mul(particles.velZ, normalZ)));
+		Float tangentX = Simd::sub(particles.velX, Simd::mul(normalSpeed, normalX));
+		Float tangentY = Simd::sub(particles.velY, Simd::mul(normalSpeed, normalY));
+		Float tangentZ = Simd::sub(particles.velZ, Simd::mul(normalSpeed, normalZ));
+		Float bouncedNormalSpeed = Simd::sub(zero, Simd::mul(normalSpeed, surface.restitution));
+
+		typename Simd::Mask bouncing = Simd::andMask(colliding, Simd::greaterThan(zero, normalSpeed));
+		particles.velX = Simd::blend(particles.velX, Simd::mulAdd(tangentX, surface.tangentialScale, Simd::mul(bouncedNormalSpeed, normalX)), bouncing);
+		particles.velY = Simd::blend(particles.velY, Simd::mulAdd(tangentY, surface.tangentialScale, Simd::mul(bouncedNormalSpeed, normalY)), bouncing);
+		particles.velZ = Simd::blend(particles.velZ, Simd::mulAdd(tangentZ, surface.tangentialScale, Simd::mul(bouncedNormalSpeed, normalZ)), bouncing);
+	}
+
+	// Keeps particles on the outer side of colliderSettings.planes[index].
+	template<int index>
+	struct PlaneCollider {
+		template<typename Simd>
+		struct Vectors {
+			typename Simd::Float normalX, normalY, normalZ, offset;
+			SurfaceVectors<Simd> surface;
+
+			Vectors() : surface(colliderSettings.planes[index].surface) {
+				const Plane &plane = colliderSettings.planes[index];
+				normalX = Simd::set(plane.normal.x);
+				normalY = Simd::set(plane.normal.y);
+				normalZ = Simd::set(plane.normal.z);
+				offset = Simd::set(plane.offset);
+			}
+
+			void collide(Motion<Simd> &particles) const {
+				typename Simd::Float depth = Simd::sub(offset,
+					Simd::mulAdd(particles.posX, normalX, Simd::mulAdd(particles.posY, normalY, Simd::mul(particles.posZ, normalZ))));
+
+				resolveCollision(particles, Simd::greaterThan(depth, Simd::set(0.0f)), depth, normalX, normalY, normalZ, surface);
+			}
+		};
+	};
+
+	// Keeps particles outside colliderSettings.spheres[index].
+	template<int index>
+	struct SphereCollider {
+		template<typename Simd>
+		struct Vectors {
+			typename Simd::Float centerX, centerY, centerZ, radius;
+			SurfaceVectors<Simd> surface;
+
+			Vectors() : surface(colliderSettings.spheres[index].surface) {
+				const Sphere &sphere = colliderSettings.spheres[index];
+				centerX = Simd::set(sphere.center.x);
+				centerY = Simd::set(sphere.center.y);
+				centerZ = Simd::set(sphere.center.z);
+				radius = Simd::set(sphere.radius);
+			}
+
+			void collide(Motion<Simd> &particles) const {
+				typedef typename Simd::Float Float;
+
+				Float dx = Simd::sub(particles.posX, centerX);
+				Float dy = Simd::sub(particles.posY, centerY);
+				Float dz = Simd::sub(particles.posZ, centerZ);
+				Float distance = Simd::sqrt(Simd::mulAdd(dx, dx, Simd::mulAdd(dy, dy, Simd::mul(dz, dz))));
+				Float depth = Simd::sub(radius, distance);
+
+				// Guards the division for a particle exactly at the center, which has no direction to be pushed out in and stays put
+				Float inverseDistance = Simd::div(Simd::set(1.0f), Simd::maximum(distance, Simd::set(1e-12f)));
+
+				resolveCollision(particles, Simd::greaterThan(depth, Simd::set(0.0f)), depth,
+					Simd::mul(dx, inverseDistance), Simd::mul(dy, inverseDistance), Simd::mul(dz, inverseDistance), surface);
+			}
+		};
+	};
+
+	// Keeps particles outside colliderSettings.boxes[index]. Particles inside are pushed out through the nearest face.
+	template<int index>
+	struct BoxCollider {
+		template<typename Simd>
+		struct Vectors {
+			typename Simd::Float centerX, centerY, centerZ, halfExtents[3], axes[3][3];
+			SurfaceVectors<Simd> surface;
+
+			Vectors() : surface(colliderSettings.boxes[index].surface) {
+				const Box &box = colliderSettings.boxes[index];
+				centerX = Simd::set(box.center.x);
+				centerY = Simd::set(box.center.y);
+				centerZ = Simd::set(box.center.z);
+
+				for (int a = 0; a < 3; a++) {
+					halfExtents[a] = Simd::set(box.halfExtents[a]);
+					for (int c = 0; c < 3; c++) axes[a][c] = Simd::set(box.axes[a][c]);
+				}
+			}
+
+			void collide(Motion<Simd> &particles) const {
+				typedef typename Simd::Float Float;
+				typedef typename Simd::Mask Mask;
+				const Float zero = Simd::set(0.0f);
+
+				Float dx = Simd::sub(particles.posX, centerX);
+				Float dy = Simd::sub(particles.posY, centerY);
+				Float dz = Simd::sub(particles.posZ, centerZ);
+
+				// The position in the box's own coordinates, and how far inside each pair of faces it is
+				Float local[3], depths[3];
+				for (int a = 0; a < 3; a++) {
+					local[a] = Simd::mulAdd(dx, axes[a][0], Simd::mulAdd(dy, axes[a][1], Simd::mul(dz, axes[a][2])));
+					depths[a] = Simd::sub(halfExtents[a], Simd::maximum(local[a], Simd::sub(zero, local[a])));
+				}
+
+				Mask inside = Simd::andMask(Simd::greaterThan(depths[0], zero),
+					Simd::andMask(Simd::greaterThan(depths[1], zero), Simd::greaterThan(depths[2], zero)));
+
+				// The axis with the least depth is the nearest pair of faces, and the sign of the local position picks the face
+				Float depth = depths[0];
+				Float normalX = axes[0][0], normalY = axes[0][1], normalZ = axes[0][2];
+				Float side = local[0];
+
+				for (int a = 1; a < 3; a++) {
+					Mask nearer = Simd::greaterThan(depth, depths[a]);
+					depth = Simd::blend(depth, depths[a], nearer);
+					normalX = Simd::blend(normalX, axes[a][0], nearer);
+					normalY = Simd::blend(normalY, axes[a][1], nearer);
+					normalZ = Simd::blend(normalZ, axes[a][2], nearer);
+					side = Simd::blend(side, local[a], nearer);
+				}
+
+				Mask negativeSide = Simd::greaterThan(zero, side);
+				normalX = Simd::blend(normalX, Simd::sub(zero, normalX), negativeSide);
+				normalY = Simd::blend(normalY, Simd::sub(zero, normalY), negativeSide);
+				normalZ = Simd::blend(normalZ, Simd::sub(zero, normalZ), negativeSide);
+
+				resolveCollision(particles, inside, depth, normalX, normalY, normalZ, surface);
+			}
+		};
+	};
+
+	// Applies each collider in the list in turn, in the same way as ForceList.
+	template<typename... Colliders>
+	struct ColliderList;
+
+	template<>
+	struct ColliderList<> {
+		template<typename Simd>
+		struct Vectors {
+			void collide(Motion<Simd> &) const {}
+		};
+	};
+
+	template<typename First, typename... Rest>
+	struct ColliderList<First, Rest...> {
+		template<typename Simd>
+		struct Vectors {
+			typename First::template Vectors<Simd> first;
+			typename ColliderList<Rest...>::template Vectors<Simd> rest;
+
+			void collide(Motion<Simd> &particles) const {
+				first.collide(particles);
+				rest.collide(particles);
+			}
+		};
+	};
+
+	// The colliders the application simulates.
+	typedef ColliderList<PlaneCollider<0>, PlaneCollider<1>, PlaneCollider<2>, PlaneCollider<3>, PlaneCollider<4>, SphereCollider<0>, BoxCollider<0>> Colliders;
+	bool simulateColliders = true;
+
+	// Puts extrapolated render positions back on the surface of any collider they moved into, and no lower than
+	// groundLevel. The positions are those prepareRenderableParticles() gathered, so whole vectors are read up to
+	// particleCapacity.
+	template<typename Simd>
+	void constrainPositionsWith(uint32_t count, bool collide, float *x, float *y, float *z) {
+		const Colliders::Vectors<Simd> colliders;
+		const typename Simd::Float zero = Simd::set(0.0f), groundLevelVector = Simd::set(groundLevel);
+
+		for (uint32_t i = 0; i < count; i += Simd::width) {
+			Motion<Simd> particles = { Simd::loadUnaligned(x + i), Simd::loadUnaligned(y + i), Simd::loadUnaligned(z + i), zero, zero, zero, i };
+			if (collide) colliders.collide(particles);
+
+			Simd::storeUnaligned(x + i, particles.posX);
+			Simd::storeUnaligned(y + i, Simd::blend(particles.posY, groundLevelVector, Simd::greaterThan(particles.posY, groundLevelVector)));
+			Simd::storeUnaligned(z + i, particles.posZ);
+		}
+	}
+
+	SIMD_KERNEL_SCALAR void constrainPositionsScalar(uint32_t count, bool collide, float *x, float *y, float *z) { constrainPositionsWith<simd::Scalar>(count, collide, x, y, z); }
+	SIMD_KERNEL_SSE4 void constrainPositionsSse4(uint32_t count, bool collide, float *x, float *y, float *z) { constrainPositionsWith<simd::Sse4>(count, collide, x, y, z); }
+	SIMD_KERNEL_AVX2 void constrainPositionsAvx2(uint32_t count, bool collide, float *x, float *y, float *z) { constrainPositionsWith<simd::Avx2>(count, collide, x, y, z); }
+	SIMD_KERNEL_AVX512 void constrainPositionsAvx512(uint32_t count, bool collide, float *x, float *y, float *z) { constrainPositionsWith<simd::Avx512>(count, collide, x, y, z); }
+
+	typedef void(*ConstrainPositionsFunction)(uint32_t count, bool collide, float *x, float *y, float *z);
+	ConstrainPositionsFunction constrainPositionsFunction = nullptr;
+
+	void selectConstrainPositionsFunction(simd::Level level) {
+		switch (level) {
+		case simd::Level::sse4: constrainPositionsFunction = constrainPositionsSse4; break;
+		case simd::Level::avx2: constrainPositionsFunction = constrainPositionsAvx2; break;
+		case simd::Level::avx512: constrainPositionsFunction = constrainPositionsAvx512; break;
+		default: constrainPositionsFunction = constrainPositionsScalar; break;
+		}
+	}
+
+	// Fills the slots of a chunk's dead particles with the live particles from its end, so the live particles stay dense at
+	// its front. Only the particles that died are touched. deadParticles must be in ascending order.
+	template<typename Layout>
+	void removeDeadParticles(Chunk &chunk, const uint32_t *deadParticles, uint32_t deadCount) {
+		uint32_t liveEnd = chunk.firstParticle + chunk.liveCount;
+		uint32_t newLiveEnd = liveEnd - deadCount;
+		uint32_t back = deadCount;
+
+		for (uint32_t front = 0; front < back && deadParticles[front] < newLiveEnd; front++) {
+			// Find the last particle that is still live, skipping any that died
+			liveEnd--;
+			while (back > front && deadParticles[back - 1] == liveEnd) {
+				back--;
+				liveEnd--;
+			}
+
+			for (int a = 0; a < attributeCount; a++) {
+				memcpy(Layout::find(state, particleCapacity, (Attribute)a, deadParticles[front]),
+					Layout::find(state, particleCapacity, (Attribute)a, liveEnd), Layout::Precision::size((Attribute)a));
+			}
+		}
+
+		chunk.liveCount -= deadCount;
+	}
+
+	template<typename Simd, typename Layout, typename Access, typename ForceListType, typename ColliderListType>
+	void updateRangeWith(uint32_t firstChunk, uint32_t endChunkExclusive) {
+		typedef typename Simd::Float Float;
+		typedef typename Simd::Mask Mask;
+
+		const typename ForceListType::template Vectors<Simd> forces;
+		const typename ColliderListType::template Vectors<Simd> colliders;
+
+		// Chunks the update-rate LOD has skipped are updated by the time they skipped as well as this step's, so the step
+		// size is set per chunk, whenever it changes. Ages are in real seconds, like the emitters' rates and lifetimes.
+		const IntegratorScheme &scheme = integratorSchemes[(int)integrator];
+		IntegratorVectors<Simd> integration(scheme, stepSize);
+		Float ageStepVector = Simd::set(0.0f);
+		float integratedStepTime = -1.0f;
+
+		Float groundLevelVector = Simd::set(groundLevel);
+
+		RandomGenerator<Simd> rng(stepIndex);
+
+		// The particles of the current chunk that died in this step, in ascending order
+		uint32_t deadParticles[particlesPerChunk];
+		uint32_t deadCount = 0;
+
+		// The last vector of a chunk's live particles may extend past them. Its lanes beyond the end are masked off
+		// and their old values are written back unchanged. It is updated separately
+		// so that the full vectors in the main loop don't pay for the masking.
+		auto updateVector = [&](uint32_t i, bool isPartialVector, const Mask &liveLanes) {
+			if (Access::prefetch && i % simd::maxWidth == 0) Layout::prefetch(state, particleCapacity, i + prefetchDistance);
+
+			uint8_t *posXPtr = Layout::find(state, particleCapacity, positionX, i);
+			uint8_t *posYPtr = Layout::find(state, particleCapacity, positionY, i);
+			uint8_t *posZPtr = Layout::find(state, particleCapacity, positionZ, i);
+			uint8_t *agePtr = Layout::find(state, particleCapacity, age, i);
+			uint8_t *velXPtr = Layout::find(state, particleCapacity, velocityX, i);
+			uint8_t *velYPtr = Layout::find(state, particleCapacity, velocityY, i);
+			uint8_t *velZPtr = Layout::find(state, particleCapacity, velocityZ, i);
+			uint8_t *lifetimePtr = Layout::find(state, particleCapacity, lifetime, i);
+
+			Motion<Simd> motion;
+			motion.firstParticle = i;
+			motion.posX = loadAttribute<Simd, Layout>(posXPtr, positionX);
+			motion.posY = loadAttribute<Simd, Layout>(posYPtr, positionY);
+			motion.posZ = loadAttribute<Simd, Layout>(posZPtr, positionZ);
+			motion.velX = loadAttribute<Simd, Layout>(velXPtr, velocityX);
+			motion.velY = loadAttribute<Simd, Layout>(velYPtr, velocityY);
+			motion.velZ = loadAttribute<Simd, Layout>(velZPtr, velocityZ);
+
+			Motion<Simd> moved = integration.advance(motion, forces);
+
+			// Particles that moved into a collider are put back on its surface and bounce, in this same pass.
+			colliders.collide(moved);
+
+			Float posX = moved.posX, posY = moved.posY, posZ = moved.posZ;
+			Float velX = moved.velX, velY = moved.velY, velZ = moved.velZ;
+
+			Float ages = Simd::add(loadAttribute<Simd, Layout>(agePtr, age), ageStepVector);
+
+			// Particles die when they reach their lifetime or fall out of view below groundLevel.
+			// They are recorded here and removed once the whole chunk has been updated.
+			Mask dying = Simd::orMask(Simd::greaterThan(ages, loadAttribute<Simd, Layout>(lifetimePtr, lifetime)), Simd::greaterThan(posY, groundLevelVector));
+			if (isPartialVector) dying = Simd::andMask(dying, liveLanes);
+
+			for (uint32_t dyingBits = Simd::maskBits(dying); dyingBits != 0; dyingBits &= dyingBits - 1) {
+				deadParticles[deadCount++] = i + simd::lowestBitIndex(dyingBits);
+			}
+
+			if (isPartialVector) {
+				posX = Simd::blend(motion.posX, posX, liveLanes);
+				posY = Simd::blend(motion.posY, posY, liveLanes);
+				posZ = Simd::blend(motion.posZ, posZ, liveLanes);
+				ages = Simd::blend(loadAttribute<Simd, Layout>(agePtr, age), ages, liveLanes);
+				velX = Simd::blend(motion.velX, velX, liveLanes);
+				velY = Simd::blend(motion.velY, velY, liveLanes);
+				velZ = Simd::blend(motion.velZ, velZ, liveLanes);
+			}
+
+			storeAttribute<Simd, Layout>(posXPtr, positionX, posX);
+			storeAttribute<Simd, Layout>(posYPtr, positionY, posY);
+			storeAttribute<Simd, Layout>(posZPtr, positionZ, posZ);
+			storeAttribute<Simd, Layout>(agePtr, age, ages);
+			storeAttribute<Simd, Layout>(velXPtr, velocityX, velX);
+			storeAttribute<Simd, Layout>(velYPtr, velocityY, velY);
+			storeAttribute<Simd, Layout>(velZPtr, velocityZ, velZ);
+		};
+
+		const Mask allLanes = Simd::firstLanes(Simd::width);
+
+		for (uint32_t c = firstChunk; c < endChunkExclusive; c++) {
+			Chunk &chunk = chunks[c];
+			if (!chunk.stepping) continue;
+
+			if (chunk.stepTime != integratedStepTime) {
+				integration = IntegratorVectors<Simd>(scheme, chunk.stepTime * simulationSpeed);
+				ageStepVector = Simd::set(chunk.stepTime);
+				integratedStepTime = chunk.stepTime;
+			}
+
+			uint32_t liveEnd = chunk.firstParticle + chunk.liveCount;
+			uint32_t fullVectorsEnd = liveEnd - chunk.liveCount % Simd::width;
+
+			deadCount = 0;
+			for (uint32_t i = chunk.firstParticle; i < fullVectorsEnd; i += Simd::width) updateVector(i, false, allLanes);
+			if (fullVectorsEnd < liveEnd) updateVector(fullVectorsEnd, true, Simd::firstLanes(liveEnd - fullVectorsEnd));
+
+			if (deadCount > 0) removeDeadParticles<Layout>(chunk, deadParticles, deadCount);
+
+			// Spawning follows integration so that spawned particles are drawn at their emitter before they first move.
+			// Brightness and lifetime are only written here, so they cost no bandwidth for the particles that aren't spawning.
+			if (chunk.spawnCount > 0) {
+				uint32_t spawnStart = chunk.firstParticle + chunk.liveCount;
+				spawnRangeWith<Simd, Layout>(emitterSpawnValues[chunk.emitterIndex], rng, spawnStart, spawnStart + chunk.spawnCount);
+				chunk.liveCount += chunk.spawnCount;
+			}
+		}
+	}
+
+	// One entry point per instruction set, each compiled for that instruction set.
+	template<typename Layout, typename Access, typename ForceListType, typename ColliderListType> SIMD_KERNEL_SCALAR void updateRangeScalar(uint32_t firstChunk, uint32_t endChunkExclusive) {
+		updateRangeWith<simd::Scalar, Layout, Access, ForceListType, ColliderListType>(firstChunk, endChunkExclusive);
+	}
+
+	template<typename Layout, typename Access, typename ForceListType, typename ColliderListType> SIMD_KERNEL_SSE4 void updateRangeSse4(uint32_t firstChunk, uint32_t endChunkExclusive) {
+		updateRangeWith<simd::Sse4, Layout, Access, ForceListType, ColliderListType>(firstChunk, endChunkExclusive);
+	}
+
+	template<typename Layout, typename Access, typename ForceListType, typename ColliderListType> SIMD_KERNEL_AVX2 void updateRangeAvx2(uint32_t firstChunk, uint32_t endChunkExclusive) {
+		updateRangeWith<simd::Avx2, Layout, Access, ForceListType, ColliderListType>(firstChunk, endChunkExclusive);
+	}
+
+	template<typename Layout, typename Access, typename ForceListType, typename ColliderListType> SIMD_KERNEL_AVX512 void updateRangeAvx512(uint32_t firstChunk, uint32_t endChunkExclusive) {
+		updateRangeWith<simd::Avx512, Layout, Access, ForceListType, ColliderListType>(firstChunk, endChunkExclusive);
+	}
+
+	typedef void(*UpdateRangeFunction)(uint32_t firstChunk, uint32_t endChunkExclusive);
+	UpdateRangeFunction updateRangeFunction = nullptr;
+
+	template<typename Layout, typename Access, typename ForceListType, typename ColliderListType>
+	UpdateRangeFunction findUpdateRangeFunction(simd::Level level) {
+		switch (level) {
+		case simd::Level::sse4: return updateRangeSse4<Layout, Access, ForceListType, ColliderListType>;
+		case simd::Level::avx2: return updateRangeAvx2<Layout, Access, ForceListType, ColliderListType>;
+		case simd::Level::avx512: return updateRangeAvx512<Layout, Access, ForceListType, ColliderListType>;
+		default: return updateRangeScalar<Layout, Access, ForceListType, ColliderListType>;
+		}
+	}
+
+	template<typename Precision, typename Access, typename ForceListType, typename ColliderListType>
+	UpdateRangeFunction findUpdateRangeFunctionForLayout(simd::Level level) {
+		switch (layout) {
+		case ParticleLayout::aosoa8: return findUpdateRangeFunction<AoSoALayout<8, Precision>, Access, ForceListType, ColliderListType>(level);
+		case ParticleLayout::aosoa16: return findUpdateRangeFunction<AoSoALayout<16, Precision>, Access, ForceListType, ColliderListType>(level);
+		default: return findUpdateRangeFunction<SoALayout<Precision>, Access, ForceListType, ColliderListType>(level);
+		}
+	}
+
+	template<typename Access, typename ForceListType, typename ColliderListType>
+	UpdateRangeFunction findUpdateRangeFunctionForPrecision(simd::Level level) {
+		if (precision == StoragePrecision::half) return findUpdateRangeFunctionForLayout<HalfPrecision, Access, ForceListType, ColliderListType>(level);
+		return findUpdateRangeFunctionForLayout<FullPrecision, Access, ForceListType, ColliderListType>(level);
+	}
+
+	// The fluid always has the colliders, which hold it in.
+	template<typename Access>
+	UpdateRangeFunction findUpdateRangeFunctionForPhysics(simd::Level level) {
+		if (simulationMode == SimulationMode::fluid) return findUpdateRangeFunctionForPrecision<Access, FluidForces, Colliders>(level);
+		if (!simulateColliders) return findUpdateRangeFunctionForPrecision<Access, Forces, ColliderList<>>(level);
+		if (simulateAllForces) return findUpdateRangeFunctionForPrecision<Access, AllForces, Colliders>(level);
+		return findUpdateRangeFunctionForPrecision<Access, Forces, Colliders>(level);
+	}
+
+	// In analytic mode a particle's path is a closed-form function of its spawn values and its age, so nothing is
+	// stored as it moves. The position attributes hold where it spawned, the velocity attributes its initial velocity
+	// and the age attribute the elapsedTime it spawned at. A step only reads the attributes it needs to find the dying
+	// particles, and render() evaluates the positions at the time the frame is drawn. Only gravity and linear drag are
+	// simulated, and changing them changes the paths of the particles already live. The spawn times are floats, so the
+	// ages lose precision slowly, to about a quarter of a millisecond after an hour.
+
+	// e^x for x <= 0, to within a couple of float ulps, from a polynomial on [-ln 2 / 2, ln 2 / 2] scaled by a power of
+	// two built in the exponent bits. Below -87 the result would be denormal, so it stops there.
+	template<typename Simd>
+	typename Simd::Float exponential(const typename Simd::Float &exponent) {
+		typedef typename Simd::Float Float;
+
+		const Float x = Simd::maximum(exponent, Simd::set(-87.0f));
+		Float n = Simd::floor(Simd::mulAdd(x, Simd::set(1.44269504f), Simd::set(0.5f)));
+
+		// ln 2 in two parts, so that n ln 2 is subtracted without rounding
+		Float r = Simd::sub(Simd::sub(x, Simd::mul(n, Simd::set(0.693359375f))), Simd::mul(n, Simd::set(-2.12194440e-4f)));
+
+		Float p = Simd::mulAdd(Simd::set(1.9875691500e-4f), r, Simd::set(1.3981999507e-3f));
+		p = Simd::mulAdd(p, r, Simd::set(8.3334519073e-3f));
+		p = Simd::mulAdd(p, r, Simd::set(4.1665795894e-2f));
+		p = Simd::mulAdd(p, r, Simd::set(1.6666665459e-1f));
+		p = Simd::mulAdd(p, r, Simd::set(5.0000001201e-1f));
+		p = Simd::mulAdd(Simd::mul(p, r), r, Simd::add(r, Simd::set(1.0f)));
+
+		typename Simd::Int exponentBits = Simd::template shiftLeft<23>(Simd::addInt(Simd::truncateToInt(n), Simd::setInt(127)));
+		return Simd::mul(p, Simd::asFloat(exponentBits));
+	}
+
+	// With linear drag k, after simulated time t from position p and velocity v:
+	//   position = p + v t (1 - kt h) + gravity t^2 h
+	//   velocity = v (1 - kt + (kt)^2 h) + gravity t (1 - kt h)
+	// where h = (kt - 1 + e^-kt) / (kt)^2, which tends to 1/2 without drag. Below kt = 0.1 h comes from its series,
+	// as the exact form loses its precision to cancellation there.
+	template<typename Simd>
+	struct BallisticPath {
+		typedef typename Simd::Float Float;
+
+		Float gravityX, gravityY, gravityZ, drag, speed;
+
+		BallisticPath() : gravityX(Simd::set(forceSettings.gravity.x)), gravityY(Simd::set(forceSettings.gravity.y)),
+			gravityZ(Simd::set(forceSettings.gravity.z)), drag(Simd::set(forceSettings.linearDrag)), speed(Simd::set(simulationSpeed)) {}
+
+		// How far a particle has moved per unit of its initial velocity and per unit of gravity after ages real seconds,
+		// and the fraction of its initial velocity it has left.
+		void findDistances(const Float &ages, Float &perVelocity, Float &perGravity, Float &decay) const {
+			const Float one = Simd::set(1.0f);
+			const Float seriesLimit = Simd::set(0.1f);
+
+			Float time = Simd::mul(ages, speed);
+			Float kt = Simd::mul(drag, time);
+
+			Float series = Simd::mulAdd(kt, Simd::set(1 / 720.0f), Simd::set(-1 / 120.0f));
+			series = Simd::mulAdd(series, kt, Simd::set(1 / 24.0f));
+			series = Simd::mulAdd(series, kt, Simd::set(-1 / 6.0f));
+			series = Simd::mulAdd(series, kt, Simd::set(0.5f));
+
+			Float safeKt = Simd::maximum(kt, seriesLimit);
+			Float exact = Simd::div(Simd::add(Simd::sub(safeKt, one), exponential<Simd>(Simd::sub(Simd::set(0.0f), safeKt))), Simd::mul(safeKt, safeKt));
+			Float h = Simd::blend(series, exact, Simd::greaterThan(kt, seriesLimit));
+
+			Float kth = Simd::mul(kt, h);
+			perVelocity = Simd::sub(time, Simd::mul(time, kth));
+			perGravity = Simd::mul(Simd::mul(time, time), h);
+			decay = Simd::add(Simd::sub(one, kt), Simd::mul(kt, kth));
+		}
+	};
+
+	// The analytic mode's step: finds the particles that have reached their lifetime or the ground, and spawns. Only
+	// the spawn time, lifetime and the vertical parts of the spawn position and velocity are read, and the live
+	// particles aren't written at all.
+	template<typename Simd, typename Layout>
+	void evaluateRangeWith(uint32_t firstChunk, uint32_t endChunkExclusive) {
+		typedef typename Simd::Float Float;
+		typedef typename Simd::Mask Mask;
+
+		const BallisticPath<Simd> path;
+		const Float now = Simd::set((float)elapsedTime);
+		const Float groundLevelVector = Simd::set(groundLevel);
+
+		RandomGenerator<Simd> rng(stepIndex);
+
+		uint32_t deadParticles[particlesPerChunk];
+		uint32_t deadCount = 0;
+
+		auto findDying = [&](uint32_t i, const Mask &liveLanes) {
+			Float ages = Simd::sub(now, loadAttribute<Simd, Layout>(Layout::find(state, particleCapacity, age, i), age));
+
+			Float perVelocity, perGravity, decay;
+			path.findDistances(ages, perVelocity, perGravity, decay);
+
+			Float posY = Simd::mulAdd(loadAttribute<Simd, Layout>(Layout::find(state, particleCapacity, velocityY, i), velocityY), perVelocity,
+				Simd::mulAdd(path.gravityY, perGravity, loadAttribute<Simd, Layout>(Layout::find(state, particleCapacity, positionY, i), positionY)));
+
+			Float lifetimes = loadAttribute<Simd, Layout>(Layout::find(state, particleCapacity, lifetime, i), lifetime);
+			Mask dying = Simd::andMask(Simd::orMask(Simd::greaterThan(ages, lifetimes), Simd::greaterThan(posY, groundLevelVector)), liveLanes);
+
+			for (uint32_t dyingBits = Simd::maskBits(dying); dyingBits != 0; dyingBits &= dyingBits - 1) {
+				deadParticles[deadCount++] = i + simd::lowestBitIndex(dyingBits);
+			}
+		};
+
+		const Mask allLanes = Simd::firstLanes(Simd::width);
+
+		for (uint32_t c = firstChunk; c < endChunkExclusive; c++) {
+			Chunk &chunk = chunks[c];
+			uint32_t liveEnd = chunk.firstParticle + chunk.liveCount;
+			uint32_t fullVectorsEnd = liveEnd - chunk.liveCount % Simd::width;
+
+			deadCount = 0;
+			for (uint32_t i = chunk.firstParticle; i < fullVectorsEnd; i += Simd::width) findDying(i, allLanes);
+			if (fullVectorsEnd < liveEnd) findDying(fullVectorsEnd, Simd::firstLanes(liveEnd - fullVectorsEnd));
+
+			if (deadCount > 0) removeDeadParticles<Layout>(chunk, deadParticles, deadCount);
+
+			if (chunk.spawnCount > 0) {
+				uint32_t spawnStart = chunk.firstParticle + chunk.liveCount;
+				spawnRangeWith<Simd, Layout>(emitterSpawnValues[chunk.emitterIndex], rng, spawnStart, spawnStart + chunk.spawnCount, (float)elapsedTime);
+				chunk.liveCount += chunk.spawnCount;
+			}
+		}
+	}
+
+	// Evaluates the positions of count particles from firstParticle at time, in elapsedTime's seconds, into x, y and z.
+	// Whole vectors are evaluated, so up to a vector's worth of positions past count are written too.
+	template<typename Simd, typename Layout>
+	void evaluatePositionsWith(uint32_t firstParticle, uint32_t count, float time, float *x, float *y, float *z) {
+		typedef typename Simd::Float Float;
+
+		const BallisticPath<Simd> path;
+		const Float timeVector = Simd::set(time);
+		const Float gravity[3] = { path.gravityX, path.gravityY, path.gravityZ };
+		const Attribute positionAttributes[3] = { positionX, positionY, positionZ };
+		const Attribute velocityAttributes[3] = { velocityX, velocityY, velocityZ };
+		float *destinations[3] = { x, y, z };
+
+		for (uint32_t i = 0; i < count; i += Simd::width) {
+			uint32_t particle = firstParticle + i;
+			Float ages = Simd::sub(timeVector, loadAttribute<Simd, Layout>(Layout::find(state, particleCapacity, age, particle), age));
+
+			Float perVelocity, perGravity, decay;
+			path.findDistances(ages, perVelocity, perGravity, decay);
+
+			for (int c = 0; c < 3; c++) {
+				Float spawnPosition = loadAttribute<Simd, Layout>(Layout::find(state, particleCapacity, positionAttributes[c], particle), positionAttributes[c]);
+				Float velocity = loadAttribute<Simd, Layout>(Layout::find(state, particleCapacity, velocityAttributes[c], particle), velocityAttributes[c]);
+				Simd::storeUnaligned(destinations[c] + i, Simd::mulAdd(velocity, perVelocity, Simd::mulAdd(gravity[c], perGravity, spawnPosition)));
+			}
+		}
+	}
+
+	// One entry point per instruction set for each analytic kernel, as for updateRange().
+	template<typename Layout> SIMD_KERNEL_SCALAR void evaluateRangeScalar(uint32_t firstChunk, uint32_t endChunkExclusive) { evaluateRangeWith<simd::Scalar, Layout>(firstChunk, endChunkExclusive); }
+	template<typename Layout> SIMD_KERNEL_SSE4 void evaluateRangeSse4(uint32_t firstChunk, uint32_t endChunkExclusive) { evaluateRangeWith<simd::Sse4, Layout>(firstChunk, endChunkExclusive); }
+	template<typename Layout> SIMD_KERNEL_AVX2 void evaluateRangeAvx2(uint32_t firstChunk, uint32_t endChunkExclusive) { evaluateRangeWith<simd::Avx2, Layout>(firstChunk, endChunkExclusive); }
+	template<typename Layout> SIMD_KERNEL_AVX512 void evaluateRangeAvx512(uint32_t firstChunk, uint32_t endChunkExclusive) { evaluateRangeWith<simd::Avx512, Layout>(firstChunk, endChunkExclusive); }
+
+	template<typename Layout> SIMD_KERNEL_SCALAR void evaluatePositionsScalar(uint32_t firstParticle, uint32_t count, float time, float *x, float *y, float *z) {
+		evaluatePositionsWith<simd::Scalar, Layout>(firstParticle, count, time, x, y, z);
+	}
+
+	template<typename Layout> SIMD_KERNEL_SSE4 void evaluatePositionsSse4(uint32_t firstParticle, uint32_t count, float time, float *x, float *y, float *z) {
+		evaluatePositionsWith<simd::Sse4, Layout>(firstParticle, count, time, x, y, z);
+	}
+
+	template<typename Layout> SIMD_KERNEL_AVX2 void evaluatePositionsAvx2(uint32_t firstParticle, uint32_t count, float time, float *x, float *y, float *z) {
+		evaluatePositionsWith<simd::Avx2, Layout>(firstParticle, count, time, x, y, z);
+	}
+
+	template<typename Layout> SIMD_KERNEL_AVX512 void evaluatePositionsAvx512(uint32_t firstParticle, uint32_t count, float time, float *x, float *y, float *z) {
+		evaluatePositionsWith<simd::Avx512, Layout>(firstParticle, count, time, x, y, z);
+	}
+
+	typedef void(*EvaluatePositionsFunction)(uint32_t firstParticle, uint32_t count, float time, float *x, float *y, float *z);
+	EvaluatePositionsFunction evaluatePositionsFunction = nullptr;
+
+	template<typename Layout>
+	void selectAnalyticFunctions(simd::Level level) {
+		switch (level) {
+		case simd::Level::sse4: updateRangeFunction = evaluateRangeSse4<Layout>; evaluatePositionsFunction = evaluatePositionsSse4<Layout>; break;
+		case simd::Level::avx2: updateRangeFunction = evaluateRangeAvx2<Layout>; evaluatePositionsFunction = evaluatePositionsAvx2<Layout>; break;
+		case simd::Level::avx512: updateRangeFunction = evaluateRangeAvx512<Layout>; evaluatePositionsFunction = evaluatePositionsAvx512<Layout>; break;
+		default: updateRangeFunction = evaluateRangeScalar<Layout>; evaluatePositionsFunction = evaluatePositionsScalar<Layout>; break;
+		}
+	}
+
+	template<typename Precision>
+	void selectAnalyticFunctionsForLayout(simd::Level level) {
+		switch (layout) {
+		case ParticleLayout::aosoa8: selectAnalyticFunctions<AoSoALayout<8, Precision>>(level); break;
+		case ParticleLayout::aosoa16: selectAnalyticFunctions<AoSoALayout<16, Precision>>(level); break;
+		default: selectAnalyticFunctions<SoALayout<Precision>>(level); break;
+		}
+	}
+
+	// The analytic mode stores different values in the attributes, so the live particles are converted when it is
+	// switched to or from, keeping their positions, velocities and ages. Going to the analytic mode runs each
+	// particle's path backwards from where it is now to where it would have spawned.
+	void convertAnalyticParticles(bool toAnalytic) {
+		const BallisticPath<simd::Scalar> path;
+		const vec3 gravity = forceSettings.gravity;
+		const float now = (float)elapsedTime;
+
+		for (auto &chunk : chunks) {
+			for (uint32_t i = chunk.firstParticle; i < chunk.firstParticle + chunk.liveCount; i++) {
+				float particleAge = toAnalytic ? getAttribute(age, i) : now - getAttribute(age, i);
+
+				float perVelocity, perGravity, decay;
+				path.findDistances(particleAge, perVelocity, perGravity, decay);
+
+				vec3 position(getAttribute(positionX, i), getAttribute(positionY, i), getAttribute(positionZ, i));
+				vec3 velocity(getAttribute(velocityX, i), getAttribute(velocityY, i), getAttribute(velocityZ, i));
+				vec3 newPosition, newVelocity;
+
+				if (toAnalytic) {
+					newVelocity = (velocity - gravity * perVelocity) / decay;
+					newPosition = position - newVelocity * perVelocity - gravity * perGravity;
+					setAttribute(age, i, now - particleAge);
+				}
+				else {
+					newPosition = position + velocity * perVelocity + gravity * perGravity;
+					newVelocity = velocity * decay + gravity * perVelocity;
+					setAttribute(age, i, particleAge);
+				}
+
+				for (int c = 0; c < 3; c++) {
+					setAttribute((Attribute)(positionX + c), i, newPosition[c]);
+					setAttribute((Attribute)(velocityX + c), i, newVelocity[c]);
+				}
+			}
+		}
+	}
+
+	// Automatic memory access prefetches once the particles no longer fit in the last level cache.
+	// If the CPU doesn't report its caches, the particles are assumed to fit.
+	MemoryAccess automaticMemoryAccess() {
+		static const uint64_t lastLevelCacheBytes = simd::lastLevelCacheBytes();
+		uint64_t workingSetBytes = (uint64_t)bytesPerParticle() * particleCount;
+
+		if (lastLevelCacheBytes == 0 || workingSetBytes <= lastLevelCacheBytes) return MemoryAccess::cached;
+		return MemoryAccess::prefetched;
+	}
+
+	// A vector must not straddle two AoSoA blocks, so the level is lowered until its width fits in the layout's block.
+	void selectUpdateRangeFunction(simd::Level requestedLevel) {
+		simdLevel = requestedLevel;
+		while (simd::levelWidth(simdLevel) > blockSizeOfLayout(layout)) simdLevel = (simd::Level)((int)simdLevel - 1);
+
+		memoryAccess = requestedMemoryAccess == MemoryAccess::automatic ? automaticMemoryAccess() : requestedMemoryAccess;
+		selectFluidFunctions(simdLevel);
+		selectConstrainPositionsFunction(simdLevel);
+
+		if (simulationMode == SimulationMode::analytic) {
+			if (precision == StoragePrecision::half) selectAnalyticFunctionsForLayout<HalfPrecision>(simdLevel);
+			else selectAnalyticFunctionsForLayout<FullPrecision>(simdLevel);
+			return;
+		}
+
+		switch (memoryAccess) {
+		case MemoryAccess::prefetched: updateRangeFunction = findUpdateRangeFunctionForPhysics<PrefetchedAccess>(simdLevel); break;
+		default: updateRangeFunction = findUpdateRangeFunctionForPhysics<CachedAccess>(simdLevel); break;
+		}
+	}
+
+	// The first chunk whose live and spawning particles start at or after work.
+	uint32_t findChunkAtWork(uint64_t work) {
+		return (uint32_t)(lower_bound(chunkWorkStarts.begin(), chunkWorkStarts.end() - 1, work) - chunkWorkStarts.begin());
+	}
+
+	// Ranges are divided in whole chunks, so that each chunk is compacted by one thread, with about the same number of
+	// live and spawning particles in each range. They are found at the start of every update from prepareStep()'s prefix sums.
+	void findUpdateRange(uint32_t threadIndex, uint32_t threadCount, uint32_t *firstChunk, uint32_t *endChunkExclusive) {
+		uint64_t totalWork = chunkWorkStarts.back();
+		*firstChunk = findChunkAtWork(threadIndex * totalWork / threadCount);
+		*endChunkExclusive = findChunkAtWork((threadIndex + 1) * totalWork / threadCount);
+	}
+
+	// The neighbor grid: a uniform grid of cells gridCellSize across, hashed into gridBucketCount buckets so that it needn't
+	// be bounded. The live particles' indices are counting sorted by bucket into gridParticles, and bucket b's particles
+	// are gridParticles[gridBucketStarts[b]] up to gridParticles[gridBucketStarts[b + 1]], so the end of each bucket is the
+	// start of the next. Cells that share a bucket share its particles, so lookups must check the distance to each
+	// particle they find. It is rebuilt after every step, once the particles have moved and been compacted, and is valid
+	// until the next, or until the emitters are laid out again.
+	bool enableGrid = true;
+	const float gridCellSize = 0.025f; // Also the fluid's smoothing length, so its particles' neighbors are in the 27 cells around them
+	uint32_t gridBucketCount = 0; // A power of two
+	vector<uint32_t> gridBucketStarts;
+	vector<uint32_t> gridParticles;
+	vector<uint32_t> particleBuckets; // The bucket of each live particle, by particle index
+	vector<uint32_t> particleGridSlots; // Where each live particle is in gridParticles, by particle index
+
+	// Each thread counts its own particles into its own gridBucketCount entries, so no atomics are needed. The counts
+	// are then turned into where each thread's particles start in each bucket. Threads' ranges are in particle order,
+	// so the particles in each bucket come out in ascending order whatever the thread count.
+	vector<uint32_t> gridThreadBucketCounts;
+
+	// The sums of the bucket counts in each thread's block of buckets, for the prefix sum.
+	vector<uint32_t> gridBlockStarts;
+
+	// floorf() is a library call without SSE4.1, and this is done for every particle in every step.
+	inline int floorToInt(float value) {
+		int truncated = (int)value;
+		return truncated - (value < (float)truncated ? 1 : 0);
+	}
+
+	inline ivec3 findGridCell(vec3 position) {
+		const float cellsPerUnit = 1.0f / gridCellSize;
+		return ivec3(floorToInt(position.x * cellsPerUnit), floorToInt(position.y * cellsPerUnit), floorToInt(position.z * cellsPerUnit));
+	}
+
+	// Only the rows of cells along x are hashed, and the cells of a row are in consecutive buckets, so that a row of
+	// neighboring cells is one run of buckets and of particles.
+	inline uint32_t findGridBucket(ivec3 cell) {
+		return ((uint32_t)cell.x + (((uint32_t)cell.y * 19349663u) ^ ((uint32_t)cell.z * 83492791u))) & (gridBucketCount - 1);
+	}
+
+	// Sizes the grid for the particle capacity and thread count, with at least a bucket for every particle slot. Where
+	// the particles are spread out there are nearly as many occupied cells as particles, and with fewer buckets the
+	// fluid's lookups would spend most of their time on particles from other cells that share their buckets.
+	void prepareGrid(uint32_t threadCount) {
+		gridBucketCount = 4096;
+		while (gridBucketCount < particleCapacity) gridBucketCount *= 2;
+
+		gridBucketStarts.resize(gridBucketCount + 1);
+		gridThreadBucketCounts.resize((size_t)gridBucketCount * threadCount);
+		gridBlockStarts.resize(threadCount);
+		particleBuckets.resize(particleCapacity);
+		particleGridSlots.resize(particleCapacity);
+		gridParticles.resize(particleCapacity);
+	}
+
+	// The buckets are divided evenly between threads for the passes that work on buckets rather than particles.
+	void findGridBlock(uint32_t threadIndex, uint32_t threadCount, uint32_t *firstBucket, uint32_t *endBucketExclusive) {
+		*firstBucket = (uint32_t)((uint64_t)threadIndex * gridBucketCount / threadCount);
+		*endBucketExclusive = (uint32_t)((uint64_t)(threadIndex + 1) * gridBucketCount / threadCount);
+	}
+
+	// Each thread counts the chunks of its own update range. With work stealing, the chunks at the back of the range may
+	// have been updated by thieves, so only those the thread kept are still in its caches.
+	void countGridBucketsPass(uint32_t threadIndex, uint32_t threadCount) {
+		uint32_t firstChunk, endChunkExclusive;
+		findUpdateRange(threadIndex, threadCount, &firstChunk, &endChunkExclusive);
+
+		uint32_t *counts = &gridThreadBucketCounts[(size_t)threadIndex * gridBucketCount];
+		memset(counts, 0, sizeof(uint32_t) * gridBucketCount);
+
+		uint32_t blockSize = blockSizeOfLayout(layout);
+
+		for (uint32_t c = firstChunk; c < endChunkExclusive; c++) {
+			const Chunk &chunk = chunks[c];
+			uint32_t liveEnd = chunk.firstParticle + chunk.liveCount;
+
+			for (uint32_t block = chunk.firstParticle; block < liveEnd; block += blockSize) {
+				const float *x = (const float*)findAttribute(positionX, block);
+				const float *y = (const float*)findAttribute(positionY, block);
+				const float *z = (const float*)findAttribute(positionZ, block);
+				uint32_t count = liveEnd - block < blockSize ? liveEnd - block : blockSize;
+
+				for (uint32_t i = 0; i < count; i++) {
+					uint32_t bucket = findGridBucket(findGridCell(vec3(x[i], y[i], z[i])));
+					particleBuckets[block + i] = bucket;
+					counts[bucket]++;
+				}
+			}
+		}
+	}
+
+	void sumGridBlockPass(uint32_t threadIndex, uint32_t threadCount) {
+		uint32_t firstBucket, endBucketExclusive;
+		findGridBlock(threadIndex, threadCount, &firstBucket, &endBucketExclusive);
+
+		uint32_t sum = 0;
+		for (uint32_t t = 0; t < threadCount; t++) {
+			const uint32_t *counts = &gridThreadBucketCounts[(size_t)t * gridBucketCount];
+			for (uint32_t b = firstBucket; b < endBucketExclusive; b++) sum += counts[b];
+		}
+
+		gridBlockStarts[threadIndex] = sum;
+	}
+
+	// Turns the counts into the bucket starts, and each thread's count into where its particles start in the bucket.
+	void findGridBucketStartsPass(uint32_t threadIndex, uint32_t threadCount) {
+		uint32_t firstBucket, endBucketExclusive;
+		findGridBlock(threadIndex, threadCount, &firstBucket, &endBucketExclusive);
+
+		uint32_t start = gridBlockStarts[threadIndex];
+		for (uint32_t b = firstBucket; b < endBucketExclusive; b++) {
+			gridBucketStarts[b] = start;
+
+			for (uint32_t t = 0; t < threadCount; t++) {
+				uint32_t &count = gridThreadBucketCounts[(size_t)t * gridBucketCount + b];
+				uint32_t threadStart = start;
+				start += count;
+				count = threadStart;
+			}
+		}
+	}
+
+	void scatterGridParticlesPass(uint32_t threadIndex, uint32_t threadCount) {
+		uint32_t firstChunk, endChunkExclusive;
+		findUpdateRange(threadIndex, threadCount, &firstChunk, &endChunkExclusive);
+
+		uint32_t *nextSlots = &gridThreadBucketCounts[(size_t)threadIndex * gridBucketCount];
+
+		for (uint32_t c = firstChunk; c < endChunkExclusive; c++) {
+			const Chunk &chunk = chunks[c];
+			for (uint32_t i = chunk.firstParticle; i < chunk.firstParticle + chunk.liveCount; i++) {
+				uint32_t slot = nextSlots[particleBuckets[i]]++;
+				gridParticles[slot] = i;
+				particleGridSlots[i] = slot;
+			}
+		}
+	}
+
+	// The fluid is simulated with smoothed particle hydrodynamics. Each particle's density is the sum of its neighbors'
+	// masses, weighted by how near they are, and its pressure grows with how far its density is above the rest density.
+	// The pressure pushes the particles apart where they are crowded, and the viscosity brings their velocities
+	// together. The neighbors are those within gridCellSize, found in the grid built at the end of the previous step,
+	// and the passes run before updateRange(), which adds the accelerations to the particles' other forces.
+	const float pi = 3.14159265f;
+
+	// Stands in for the positions of the particles that haven't joined the fluid yet. It is far enough from everything
+	// that they are never anyone's neighbors, and near enough that the squared distances to it don't overflow.
+	const float fluidOutsiderPosition = 1e18f;
+
+	float *fluidStorage = nullptr;
+	uint32_t fluidCapacity = 0;
+
+	// Allocates the fluid's arrays for the particle capacity. New arrays are zeroed, so the padding is never read as NaNs.
+	void prepareFluid() {
+		if (fluidCapacity == particleCapacity) return;
+
+		size_t arraySize = (size_t)particleCapacity + simd::maxWidth;
+		_mm_free(fluidStorage);
+		fluidStorage = (float*)_mm_malloc(sizeof(float) * arraySize * fluidArrayCount, 64);
+		SDL_assert_release(fluidStorage);
+		memset(fluidStorage, 0, sizeof(float) * arraySize * fluidArrayCount);
+
+		for (int a = 0; a < fluidArrayCount; a++) fluidArrays[a] = fluidStorage + arraySize * a;
+		fluidCapacity = particleCapacity;
+	}
+
+	// Without a current grid there are no neighbors to be found, so the fluid sits out the step.
+	void clearFluidAccelerations() {
+		for (int a = fluidAccelerationX; a <= fluidAccelerationZ; a++) memset(fluidArrays[a], 0, sizeof(float) * particleCapacity);
+	}
+
+	// The fluid passes divide the particles in grid order evenly between threads.
+	void findFluidRange(uint32_t threadIndex, uint32_t threadCount, uint32_t *firstSlot, uint32_t *endSlotExclusive) {
+		uint64_t particlesInGrid = gridBucketStarts[gridBucketCount];
+		*firstSlot = (uint32_t)(threadIndex * particlesInGrid / threadCount);
+		*endSlotExclusive = (uint32_t)((threadIndex + 1) * particlesInGrid / threadCount);
+	}
+
+	// Finds the ranges of gridParticles in the buckets of a cell and the 26 cells around it, one run of buckets for
+	// each of the nine rows of three cells along x, or two if the run wraps around the end of the buckets. Rows that
+	// share buckets would share their particles, so overlapping runs are merged. Returns the number of ranges.
+	uint32_t findNeighborRanges(ivec3 cell, uint32_t *starts, uint32_t *ends) {
+		uint32_t firstBuckets[18], endBuckets[18];
+		uint32_t runCount = 0;
+
+		auto addRun = [&](uint32_t first, uint32_t end) {
+			uint32_t i = runCount++;
+			for (; i > 0 && firstBuckets[i - 1] > first; i--) {
+				firstBuckets[i] = firstBuckets[i - 1];
+				endBuckets[i] = endBuckets[i - 1];
+			}
+
+			firstBuckets[i] = first;
+			endBuckets[i] = end;
+		};
+
+		for (int z = -1; z <= 1; z++) {
+			for (int y = -1; y <= 1; y++) {
+				uint32_t first = findGridBucket(cell + ivec3(-1, y, z));
+				uint32_t end = first + 3;
+
+				if (end <= gridBucketCount) addRun(first, end);
+				else {
+					addRun(first, gridBucketCount);
+					addRun(0, end - gridBucketCount);
+				}
+			}
+		}
+
+		uint32_t rangeCount = 0;
+		uint32_t first = firstBuckets[0], end = endBuckets[0];
+
+		for (uint32_t r = 1; r <= runCount; r++) {
+			if (r < runCount && firstBuckets[r] <= end) {
+				if (endBuckets[r] > end) end = endBuckets[r];
+				continue;
+			}
+
+			starts[rangeCount] = gridBucketStarts[first];
+			ends[rangeCount] = gridBucketStarts[end];
+			rangeCount++;
+
+			if (r < runCount) {
+				first = firstBuckets[r];
+				end = endBuckets[r];
+			}
+		}
+
+		return rangeCount;
+	}
+
+	// The ranges of gridParticles around the cell of a particle. Particles in grid order are mostly followed by others
+	// in the same cell, so the ranges are only found again when the cell changes.
+	struct FluidNeighbors {
+		uint32_t starts[18], ends[18];
+		uint32_t rangeCount = 0;
+		ivec3 cell;
+		bool found = false;
+
+		void findAround(uint32_t slot) {
+			const float *x = fluidArrays[fluidPositionX], *y = fluidArrays[fluidPositionY], *z = fluidArrays[fluidPositionZ];
+			ivec3 particleCell = findGridCell(vec3(x[slot], y[slot], z[slot]));
+			if (found && particleCell == cell) return;
+
+			cell = particleCell;
+			found = true;
+			rangeCount = findNeighborRanges(cell, starts, ends);
+		}
+	};
+
+	// Copies the fluid's positions and velocities into grid order. Each thread reads the chunks it updates, a block at a
+	// time. The particles that haven't joined the fluid are moved out of everyone's reach.
+	void gatherFluidPass(uint32_t threadIndex, uint32_t threadCount) {
+		uint32_t firstChunk, endChunkExclusive;
+		findUpdateRange(threadIndex, threadCount, &firstChunk, &endChunkExclusive);
+
+		uint32_t blockSize = blockSizeOfLayout(layout);
+		Attribute attributes[] = { positionX, positionY, positionZ, velocityX, velocityY, velocityZ };
+		float values[6][simd::maxWidth];
+		float ages[simd::maxWidth];
+
+		for (uint32_t c = firstChunk; c < endChunkExclusive; c++) {
+			const Chunk &chunk = chunks[c];
+			uint32_t liveEnd = chunk.firstParticle + chunk.liveCount;
+
+			for (uint32_t block = chunk.firstParticle; block < liveEnd; block += blockSize) {
+				uint32_t count = liveEnd - block < blockSize ? liveEnd - block : blockSize;
+				for (int a = 0; a < 6; a++) copyAttributeAsFloats(attributes[a], block, count, values[a]);
+				copyAttributeAsFloats(age, block, count, ages);
+
+				for (uint32_t i = 0; i < count; i++) {
+					uint32_t slot = particleGridSlots[block + i];
+					bool joined = ages[i] >= fluidSettings.joiningAge;
+
+					for (int a = 0; a < 3; a++) fluidArrays[fluidPositionX + a][slot] = joined ? values[a][i] : fluidOutsiderPosition;
+					for (int a = 3; a < 6; a++) fluidArrays[fluidPositionX + a][slot] = values[a][i];
+				}
+			}
+		}
+	}
+
+	// The densities use the poly6 kernel, which is smooth everywhere. The pressures are clamped at zero, as a fluid
+	// with a free surface would otherwise pull its surface particles into clumps. Both are stored divided by the
+	// density, as that is how the accelerations use them, so that they needn't divide for every pair of particles.
+	// The neighbors are read a vector at a time from the start of each range, and lanes masks off those past its end.
+	template<typename Simd>
+	void findFluidDensitiesWith(uint32_t firstSlot, uint32_t endSlotExclusive) {
+		typedef typename Simd::Float Float;
+		typedef typename Simd::Mask Mask;
+
+		const float h = gridCellSize;
+		const float massPoly6 = fluidSettings.particleMass * 315.0f / (64.0f * pi * powf(h, 9));
+		const Float zero = Simd::set(0.0f);
+		const Float hSquared = Simd::set(h * h);
+		const Mask allLanes = Simd::firstLanes(Simd::width);
+
+		const float *x = fluidArrays[fluidPositionX], *y = fluidArrays[fluidPositionY], *z = fluidArrays[fluidPositionZ];
+		float *inverseDensities = fluidArrays[fluidInverseDensity];
+		float *pressureRatios = fluidArrays[fluidPressureRatio];
+
+		FluidNeighbors neighbors;
+
+		for (uint32_t k = firstSlot; k < endSlotExclusive; k++) {
+			if (x[k] == fluidOutsiderPosition) {
+				inverseDensities[k] = 1.0f / fluidSettings.restDensity;
+				pressureRatios[k] = 0.0f;
+				continue;
+			}
+
+			neighbors.findAround(k);
+
+			Float px = Simd::set(x[k]), py = Simd::set(y[k]), pz = Simd::set(z[k]);
+			Float sum = zero;
+
+			for (uint32_t r = 0; r < neighbors.rangeCount; r++) {
+				uint32_t end = neighbors.ends[r];
+
+				for (uint32_t j = neighbors.starts[r]; j < end; j += Simd::width) {
+					Mask lanes = end - j < Simd::width ? Simd::firstLanes(end - j) : allLanes;
+
+					Float dx = Simd::sub(px, Simd::loadUnaligned(&x[j]));
+					Float dy = Simd::sub(py, Simd::loadUnaligned(&y[j]));
+					Float dz = Simd::sub(pz, Simd::loadUnaligned(&z[j]));
+					Float distanceSquared = Simd::mulAdd(dx, dx, Simd::mulAdd(dy, dy, Simd::mul(dz, dz)));
+
+					Float w = Simd::blend(zero, Simd::maximum(Simd::sub(hSquared, distanceSquared), zero), lanes);
+					sum = Simd::mulAdd(Simd::mul(w, w), w, sum);
+				}
+			}
+
+			// A particle is always its own neighbor, so the density is never zero.
+			float density = massPoly6 * Simd::sum(sum);
+			float pressure = fluidSettings.stiffness * (density - fluidSettings.restDensity);
+			inverseDensities[k] = 1.0f / density;
+			pressureRatios[k] = pressure > 0.0f ? pressure / density : 0.0f;
+		}
+	}
+
+	// The pressure uses the gradient of the spiky kernel, which doesn't vanish as particles meet, and the viscosity
+	// uses its Laplacian. Both are symmetric, so pairs of particles push and drag each other equally. The neighbors
+	// beyond the smoothing length, including the outsiders, contribute exactly zero, as (h - r) is clamped to zero.
+	template<typename Simd>
+	void findFluidAccelerationsWith(uint32_t firstSlot, uint32_t endSlotExclusive) {
+		typedef typename Simd::Float Float;
+		typedef typename Simd::Mask Mask;
+
+		const float h = gridCellSize;
+		const float massSpiky = fluidSettings.particleMass * 45.0f / (pi * powf(h, 6));
+		const Float zero = Simd::set(0.0f);
+		const Float half = Simd::set(0.5f);
+		const Float hVector = Simd::set(h);
+		const Float viscosity = Simd::set(fluidSettings.viscosity);
+		const Float minimumDistanceSquared = Simd::set(1e-12f);
+		const Mask allLanes = Simd::firstLanes(Simd::width);
+
+		const float *x = fluidArrays[fluidPositionX], *y = fluidArrays[fluidPositionY], *z = fluidArrays[fluidPositionZ];
+		const float *vx = fluidArrays[fluidVelocityX], *vy = fluidArrays[fluidVelocityY], *vz = fluidArrays[fluidVelocityZ];
+		const float *inverseDensities = fluidArrays[fluidInverseDensity];
+		const float *pressureRatios = fluidArrays[fluidPressureRatio];
+		float *accelerationX = fluidArrays[fluidAccelerationX];
+		float *accelerationY = fluidArrays[fluidAccelerationY];
+		float *accelerationZ = fluidArrays[fluidAccelerationZ];
+
+		FluidNeighbors neighbors;
+
+		for (uint32_t k = firstSlot; k < endSlotExclusive; k++) {
+			uint32_t particle = gridParticles[k];
+
+			if (x[k] == fluidOutsiderPosition) {
+				accelerationX[particle] = accelerationY[particle] = accelerationZ[particle] = 0.0f;
+				continue;
+			}
+
+			neighbors.findAround(k);
+
+			Float px = Simd::set(x[k]), py = Simd::set(y[k]), pz = Simd::set(z[k]);
+			Float pvx = Simd::set(vx[k]), pvy = Simd::set(vy[k]), pvz = Simd::set(vz[k]);
+			Float pressure = Simd::set(pressureRatios[k] / inverseDensities[k]);
+			Float sumX = zero, sumY = zero, sumZ = zero;
+
+			for (uint32_t r = 0; r < neighbors.rangeCount; r++) {
+				uint32_t end = neighbors.ends[r];
+
+				for (uint32_t j = neighbors.starts[r]; j < end; j += Simd::width) {
+					Mask lanes = end - j < Simd::width ? Simd::firstLanes(end - j) : allLanes;
+
+					Float dx = Simd::sub(px, Simd::loadUnaligned(&x[j]));
+					Float dy = Simd::sub(py, Simd::loadUnaligned(&y[j]));
+					Float dz = Simd::sub(pz, Simd::loadUnaligned(&z[j]));
+					Float distanceSquared = Simd::mulAdd(dx, dx, Simd::mulAdd(dy, dy, Simd::mul(dz, dz)));
+					Float distance = Simd::sqrt(Simd::maximum(distanceSquared, minimumDistanceSquared));
+					Float closeness = Simd::blend(zero, Simd::maximum(Simd::sub(hVector, distance), zero), lanes);
+					Float inverseDensity = Simd::loadUnaligned(&inverseDensities[j]);
+
+					// (pressure_i + pressure_j) / 2 density_j. A particle's own lane has a zero offset and velocity
+					// difference, so it adds nothing.
+					Float meanPressure = Simd::mul(half, Simd::mulAdd(pressure, inverseDensity, Simd::loadUnaligned(&pressureRatios[j])));
+					Float push = Simd::div(Simd::mul(Simd::mul(meanPressure, closeness), closeness), distance);
+					Float drag = Simd::mul(Simd::mul(viscosity, closeness), inverseDensity);
+
+					sumX = Simd::add(sumX, Simd::mulAdd(push, dx, Simd::mul(drag, Simd::sub(Simd::loadUnaligned(&vx[j]), pvx))));
+					sumY = Simd::add(sumY, Simd::mulAdd(push, dy, Simd::mul(drag, Simd::sub(Simd::loadUnaligned(&vy[j]), pvy))));
+					sumZ = Simd::add(sumZ, Simd::mulAdd(push, dz, Simd::mul(drag, Simd::sub(Simd::loadUnaligned(&vz[j]), pvz))));
+				}
+			}
+
+			float scale = massSpiky * inverseDensities[k];
+			accelerationX[particle] = Simd::sum(sumX) * scale;
+			accelerationY[particle] = Simd::sum(sumY) * scale;
+			accelerationZ[particle] = Simd::sum(sumZ) * scale;
+		}
+	}
+
+	// One entry point per instruction set for each fluid kernel, as for updateRange().
+	SIMD_KERNEL_SCALAR void findFluidDensitiesScalar(uint32_t firstSlot, uint32_t endSlotExclusive) { findFluidDensitiesWith<simd::Scalar>(firstSlot, endSlotExclusive); }
+	SIMD_KERNEL_SSE4 void findFluidDensitiesSse4(uint32_t firstSlot, uint32_t endSlotExclusive) { findFluidDensitiesWith<simd::Sse4>(firstSlot, endSlotExclusive); }
+	SIMD_KERNEL_AVX2 void findFluidDensitiesAvx2(uint32_t firstSlot, uint32_t endSlotExclusive) { findFluidDensitiesWith<simd::Avx2>(firstSlot, endSlotExclusive); }
+	SIMD_KERNEL_AVX512 void findFluidDensitiesAvx512(uint32_t firstSlot, uint32_t endSlotExclusive) { findFluidDensitiesWith<simd::Avx512>(firstSlot, endSlotExclusive); }
+
+	SIMD_KERNEL_SCALAR void findFluidAccelerationsScalar(uint32_t firstSlot, uint32_t endSlotExclusive) { findFluidAccelerationsWith<simd::Scalar>(firstSlot, endSlotExclusive); }
+	SIMD_KERNEL_SSE4 void findFluidAccelerationsSse4(uint32_t firstSlot, uint32_t endSlotExclusive) { findFluidAccelerationsWith<simd::Sse4>(firstSlot, endSlotExclusive); }
+	SIMD_KERNEL_AVX2 void findFluidAccelerationsAvx2(uint32_t firstSlot, uint32_t endSlotExclusive) { findFluidAccelerationsWith<simd::Avx2>(firstSlot, endSlotExclusive); }
+	SIMD_KERNEL_AVX512 void findFluidAccelerationsAvx512(uint32_t firstSlot, uint32_t endSlotExclusive) { findFluidAccelerationsWith<simd::Avx512>(firstSlot, endSlotExclusive); }
+
+	typedef void(*FluidRangeFunction)(uint32_t firstSlot, uint32_t endSlotExclusive);
+	FluidRangeFunction findFluidDensitiesFunction = nullptr;
+	FluidRangeFunction findFluidAccelerationsFunction = nullptr;
+
+	void selectFluidFunctions(simd::Level level) {
+		switch (level) {
+		case simd::Level::sse4: findFluidDensitiesFunction = findFluidDensitiesSse4; findFluidAccelerationsFunction = findFluidAccelerationsSse4; break;
+		case simd::Level::avx2: findFluidDensitiesFunction = findFluidDensitiesAvx2; findFluidAccelerationsFunction = findFluidAccelerationsAvx2; break;
+		case simd::Level::avx512: findFluidDensitiesFunction = findFluidDensitiesAvx512; findFluidAccelerationsFunction = findFluidAccelerationsAvx512; break;
+		default: findFluidDensitiesFunction = findFluidDensitiesScalar; findFluidAccelerationsFunction = findFluidAccelerationsScalar; break;
+		}
+	}
+
+	// Particles in grid order are mostly followed by their neighbors, so tasks of consecutive slots share the cells they read.
+	const uint32_t fluidTaskSlots = 512;
+
+	void findFluidDensitiesPass(uint32_t threadIndex, uint32_t threadCount) {
+		uint32_t firstSlot, endSlotExclusive;
+		findFluidRange(threadIndex, threadCount, &firstSlot, &endSlotExclusive);
+		runScheduledRange(threadIndex, threadCount, firstSlot, endSlotExclusive, gridBucketStarts[gridBucketCount], fluidTaskSlots, findFluidDensitiesFunction);
+	}
+
+	void findFluidAccelerationsPass(uint32_t threadIndex, uint32_t threadCount) {
+		uint32_t firstSlot, endSlotExclusive;
+		findFluidRange(threadIndex, threadCount, &firstSlot, &endSlotExclusive);
+		runScheduledRange(threadIndex, threadCount, firstSlot, endSlotExclusive, gridBucketStarts[gridBucketCount], fluidTaskSlots, findFluidAccelerationsFunction);
+	}
+
+	// Every reorderInterval steps, the live particles are sorted into the Morton order of their grid cells, so that particles
+	// near each other in space are near each other in memory. The neighbor grid's buckets and the fluid's passes then
+	// read runs of nearby particles rather than particles scattered across the state, and the vertex buffers draw nearby
+	// points one after another. Each emitter's particles stay in its own range, packed into the front of its chunks in
+	// their new order. 0 never reorders.
+	uint32_t reorderInterval = 0;
+
+	// Called after prepareStep() has counted the step.
+	bool isReorderStep() {
+		return reorderInterval > 0 && stepIndex % reorderInterval == 0 && simulationMode != SimulationMode::analytic;
+	}
+
+	// The sort is a least significant digit radix sort of 64-bit keys, each holding a particle's emitter index above the
+	// 30-bit Morton code of its cell, so that each emitter's particles stay together. Each pass sorts reorderDigitBits
+	// of the keys, with per-thread counts as in the grid's counting sort, and there are only as many passes as the
+	// emitter count needs. The particles are then gathered in their new order into reorderedState, which is swapped
+	// with state.
+	const uint32_t reorderDigitBits = 8;
+	const uint32_t reorderDigitCount = 1 << reorderDigitBits;
+	const uint32_t mortonBits = 30;
+
+	vector<uint64_t> reorderKeys[2];
+	vector<uint32_t> reorderSources[2]; // The particle index each key came from
+	uint32_t reorderInput = 0; // Which of the two the next pass sorts from
+	uint32_t reorderShift = 0; // The lowest bit of the digit the next pass sorts by
+	vector<uint32_t> reorderThreadDigitCounts;
+
+	// Where each chunk's live particles start in the sorted order, with the total after the last chunk. The emitters'
+	// particles are in the same places before and after sorting, so only the starts within each emitter change.
+	vector<uint32_t> reorderLiveStarts;
+
+	uint8_t *reorderedState = nullptr;
+	size_t reorderedStateSize = 0;
+
+	// Spreads the low 10 bits of value out to every third bit.
+	inline uint32_t spreadMortonBits(uint32_t value) {
+		value &= 0x3FF;
+		value = (value | (value << 16)) & 0x030000FF;
+		value = (value | (value << 8)) & 0x0300F00F;
+		value = (value | (value << 4)) & 0x030C30C3;
+		value = (value | (value << 2)) & 0x09249249;
+		return value;
+	}
+
+	// Interleaves the cell's coordinates. They wrap every 1024 cells, far beyond where the particles go.
+	inline uint32_t findMortonCode(ivec3 cell) {
+		return spreadMortonBits((uint32_t)cell.x) | (spreadMortonBits((uint32_t)cell.y) << 1) | (spreadMortonBits((uint32_t)cell.z) << 2);
+	}
+
+	// The sort passes divide the sorted order evenly between threads.
+	void findReorderRange(uint32_t threadIndex, uint32_t threadCount, uint32_t *first, uint32_t *endExclusive) {
+		uint64_t liveCount = reorderLiveStarts.back();
+		*first = (uint32_t)(threadIndex * liveCount / threadCount);
+		*endExclusive = (uint32_t)((threadIndex + 1) * liveCount / threadCount);
+	}
+
+	// Each thread finds the keys of the chunks of its own update range, which are in its caches unless they were stolen
+	// from it by the update pass.
+	void findReorderKeysPass(uint32_t threadIndex, uint32_t threadCount) {
+		uint32_t firstChunk, endChunkExclusive;
+		findUpdateRange(threadIndex, threadCount, &firstChunk, &endChunkExclusive);
+
+		uint64_t *keys = reorderKeys[0].data();
+		uint32_t *sources = reorderSources[0].data();
+		uint32_t blockSize = blockSizeOfLayout(layout);
+
+		for (uint32_t c = firstChunk; c < endChunkExclusive; c++) {
+			const Chunk &chunk = chunks[c];
+			uint32_t liveEnd = chunk.firstParticle + chunk.liveCount;
+			uint64_t emitterKey = (uint64_t)chunk.emitterIndex << mortonBits;
+			uint32_t sortedIndex = reorderLiveStarts[c];
+
+			for (uint32_t block = chunk.firstParticle; block < liveEnd; block += blockSize) {
+				const float *x = (const float*)findAttribute(positionX, block);
+				const float *y = (const float*)findAttribute(positionY, block);
+				const float *z = (const float*)findAttribute(positionZ, block);
+				uint32_t count = liveEnd - block < blockSize ? liveEnd - block : blockSize;
+
+				for (uint32_t i = 0; i < count; i++, sortedIndex++) {
+					keys[sortedIndex] = emitterKey | findMortonCode(findGridCell(vec3(x[i], y[i], z[i])));
+					sources[sortedIndex] = block + i;
+				}
+			}
+		}
+	}
+
+	void countReorderDigitsPass(uint32_t threadIndex, uint32_t threadCount) {
+		uint32_t first, endExclusive;
+		findReorderRange(threadIndex, threadCount, &first, &endExclusive);
+
+		uint32_t *counts = &reorderThreadDigitCounts[(size_t)threadIndex * reorderDigitCount];
+		memset(counts, 0, sizeof(uint32_t) * reorderDigitCount);
+
+		const uint64_t *keys = reorderKeys[reorderInput].data();
+		for (uint32_t i = first; i < endExclusive; i++) counts[(keys[i] >> reorderShift) & (reorderDigitCount - 1)]++;
+	}
+
+	// Threads' ranges are in order, so each thread's keys go after those of the threads before it with the same digit,
+	// and the sort is stable.
+	void scatterReorderKeysPass(uint32_t threadIndex, uint32_t threadCount) {
+		uint32_t first, endExclusive;
+		findReorderRange(threadIndex, threadCount, &first, &endExclusive);
+
+		uint32_t *nextSlots = &reorderThreadDigitCounts[(size_t)threadIndex * reorderDigitCount];
+		const uint64_t *keys = reorderKeys[reorderInput].data();
+		const uint32_t *sources = reorderSources[reorderInput].data();
+		uint64_t *sortedKeys = reorderKeys[1 - reorderInput].data();
+		uint32_t *sortedSources = reorderSources[1 - reorderInput].data();
+
+		for (uint32_t i = first; i < endExclusive; i++) {
+			uint32_t slot = nextSlots[(keys[i] >> reorderShift) & (reorderDigitCount - 1)]++;
+			sortedKeys[slot] = keys[i];
+			sortedSources[slot] = sources[i];
+		}
+	}
+
+	// Copies every attribute of the particles, in their sorted order, to the front of each chunk in reorderedState.
+	// Attributes are copied as they are stored, so half precision values aren't converted.
+	template<typename Layout>
+	void gatherReorderedParticlesWith(uint32_t firstChunk, uint32_t endChunkExclusive) {
+		typedef typename Layout::Precision Precision;
+		const uint32_t *sources = reorderSources[reorderInput].data();
+
+		for (uint32_t c = firstChunk; c < endChunkExclusive; c++) {
+			const Chunk &chunk = chunks[c];
+			const uint32_t *chunkSources = &sources[reorderLiveStarts[c]];
+
+			for (int a = 0; a < attributeCount; a++) {
+				uint32_t size = Precision::size((Attribute)a);
+
+				for (uint32_t i = 0; i < chunk.liveCount; i++) {
+					memcpy(Layout::find(reorderedState, particleCapacity, (Attribute)a, chunk.firstParticle + i),
+						Layout::find(state, particleCapacity, (Attribute)a, chunkSources[i]), size);
+				}
+			}
+		}
+	}
+
+	template<typename Precision>
+	void gatherReorderedParticlesForLayout(uint32_t firstChunk, uint32_t endChunkExclusive) {
+		switch (layout) {
+		case ParticleLayout::aosoa8: gatherReorderedParticlesWith<AoSoALayout<8, Precision>>(firstChunk, endChunkExclusive); break;
+		case ParticleLayout::aosoa16: gatherReorderedParticlesWith<AoSoALayout<16, Precision>>(firstChunk, endChunkExclusive); break;
+		default: gatherReorderedParticlesWith<SoALayout<Precision>>(firstChunk, endChunkExclusive); break;
+		}
+	}
+
+	// The chunks are divided between threads by where their particles start in the sorted order.
+	void gatherReorderedParticlesPass(uint32_t threadIndex, uint32_t threadCount) {
+		uint32_t first, endExclusive;
+		findReorderRange(threadIndex, threadCount, &first, &endExclusive);
+
+		auto findChunk = [](uint32_t sortedIndex) {
+			return (uint32_t)(lower_bound(reorderLiveStarts.begin(), reorderLiveStarts.end() - 1, sortedIndex) - reorderLiveStarts.begin());
+		};
+
+		uint32_t firstChunk = threadIndex == 0 ? 0 : findChunk(first);
+		uint32_t endChunkExclusive = threadIndex == threadCount - 1 ? (uint32_t)chunks.size() : findChunk(endExclusive);
+
+		if (precision == StoragePrecision::half) gatherReorderedParticlesForLayout<HalfPrecision>(firstChunk, endChunkExclusive);
+		else gatherReorderedParticlesForLayout<FullPrecision>(firstChunk, endChunkExclusive);
+	}
+
+	// Sorts the live particles into Morton order, as a part of a step after the update. The grid and the fluid's
+	// per-particle arrays are by particle index, so the step builds the grid afterwards.
+	template<typename RunPassFunction>
+	void reorderParticles(uint32_t threadCount, RunPassFunction runPass) {
+		reorderLiveStarts.resize(chunks.size() + 1);
+		reorderLiveStarts[0] = 0;
+		for (uint32_t c = 0; c < chunks.size(); c++) reorderLiveStarts[c + 1] = reorderLiveStarts[c] + chunks[c].liveCount;
+
+		uint32_t liveCount = reorderLiveStarts.back();
+		if (liveCount == 0) return;
+
+		for (int b = 0; b < 2; b++) {
+			reorderKeys[b].resize(liveCount);
+			reorderSources[b].resize(liveCount);
+		}
+
+		reorderThreadDigitCounts.resize((size_t)reorderDigitCount * threadCount);
+
+		size_t stateSize = (size_t)bytesPerParticle() * particleCapacity;
+		// Left untouched, so that the gathering threads put the pages of their chunks on their own nodes.
+		if (reorderedStateSize != stateSize) {
+			freePages(reorderedState, reorderedStateSize);
+			reorderedState = allocatePages(stateSize);
+			reorderedStateSize = stateSize;
+		}
+
+		reorderInput = 0;
+		runPass(findReorderKeysPass);
+
+		uint32_t keyBits = mortonBits;
+		while (keyBits < 64 && ((uint64_t)1 << (keyBits - mortonBits)) < emitterRanges.size()) keyBits++;
+
+		for (reorderShift = 0; reorderShift < keyBits; reorderShift += reorderDigitBits) {
+			runPass(countReorderDigitsPass);
+
+			// Turns the counts into where each thread's keys with each digit start. There are few enough to do it here.
+			uint32_t start = 0;
+			for (uint32_t d = 0; d < reorderDigitCount; d++) {
+				for (uint32_t t = 0; t < threadCount; t++) {
+					uint32_t &count = reorderThreadDigitCounts[(size_t)t * reorderDigitCount + d];
+					uint32_t threadStart = start;
+					start += count;
+					count = threadStart;
+				}
+			}
+
+			runPass(scatterReorderKeysPass);
+			reorderInput = 1 - reorderInput;
+		}
+
+		// Each emitter's particles fill its chunks from the first. Spawning fills the chunks with free slots from the
+		// first too, so the chunks stay as full as they would have been.
+		for (auto &range : emitterRanges) {
+			uint32_t emitterLiveCount = 0;
+			for (uint32_t c = range.firstChunk; c < range.firstChunk + range.chunkCount; c++) emitterLiveCount += chunks[c].liveCount;
+
+			for (uint32_t c = range.firstChunk; c < range.firstChunk + range.chunkCount; c++) {
+				chunks[c].liveCount = emitterLiveCount < chunks[c].size ? emitterLiveCount : chunks[c].size;
+				emitterLiveCount -= chunks[c].liveCount;
+				reorderLiveStarts[c + 1] = reorderLiveStarts[c] + chunks[c].liveCount;
+			}
+		}
+
+		runPass(gatherReorderedParticlesPass);
+		swap(state, reorderedState);
+	}
+
+	void setSimulationMode(SimulationMode mode) {
+		// The procedural mode has no particles to convert, so the emitters start again when it is switched to or from.
+		if ((mode == SimulationMode::procedural) != (simulationMode == SimulationMode::procedural)) restartEmitters();
+		else if ((mode == SimulationMode::analytic) != (simulationMode == SimulationMode::analytic)) convertAnalyticParticles(mode == SimulationMode::analytic);
+		simulationMode = mode;
+		selectUpdateRangeFunction(simdLevel);
+	}
+
+	SimulationMode getSimulationMode() {
+		return simulationMode;
+	}
+
+	void setIntegrator(Integrator newIntegrator) {
+		SDL_assert_release((size_t)newIntegrator < sizeof(integratorSchemes) / sizeof(integratorSchemes[0]));
+		integrator = newIntegrator;
+	}
+
+	Integrator getIntegrator() {
+		return integrator;
+	}
+
+	// The update-rate level of detail, in ballistic mode. A chunk's tier is chosen after each of its updates from its
+	// mean visibility: at updateRateLod or above it is updated every step, and each halving below that doubles its
+	// interval, up to maxStepInterval. 0 turns it off.
+	float updateRateLod = 0.0f;
+
+	// When nonzero, updateRateLod is adjusted after each step to keep the steps within this many seconds.
+	float lodStepBudget = 0.0f;
+
+	// The steps' durations differ from run to run, so the changes they make to updateRateLod are recorded for replays.
+	vector<UpdateRateLodChange> updateRateLodChanges;
+	bool replayUpdateRateLod = false;
+
+	const uint32_t maxStepInterval = 8;
+
+	// A skipped chunk catches up in one step, which must stay well short of the box collider's 0.08 thickness. At the
+	// fountain's speeds of up to about 2 units a second, 8 steps would carry a particle 0.07, and 2 steps 0.02.
+	const uint32_t maxStepIntervalWithColliders = 2;
+
+	// Chunks are sampled rather than read in full, to keep choosing their tiers cheap next to updating them.
+	const uint32_t visibilitySamplesPerChunk = 32;
+
+	bool isUpdateRateLodActive() {
+		return updateRateLod > 0.0f && simulationMode == SimulationMode::ballistic;
+	}
+
+	// The mean of the channels of the particle's color as basic.vert draws it, which darken with depth. Particles beyond
+	// the near and far planes aren't drawn at all.
+	float findVisibility(float z, float particleBrightness) {
+		if (z < 0.0f || z > 1.0f) return 0.0f;
+		return (1 - z * z) * 1.1f * (2 * particleBrightness + 1) / 3;
+	}
+
+	void chooseStepIntervals(uint32_t firstChunk, uint32_t endChunkExclusive) {
+		for (uint32_t c = firstChunk; c < endChunkExclusive; c++) {
+			Chunk &chunk = chunks[c];
+			if (!chunk.stepping || chunk.liveCount == 0) continue;
+
+			uint32_t sampleCount = chunk.liveCount < visibilitySamplesPerChunk ? chunk.liveCount : visibilitySamplesPerChunk;
+			float visibility = 0.0f;
+
+			for (uint32_t s = 0; s < sampleCount; s++) {
+				uint32_t particle = chunk.firstParticle + s * chunk.liveCount / sampleCount;
+				visibility += findVisibility(getAttribute(positionZ, particle), getAttribute(brightness, particle));
+			}
+
+			visibility /= sampleCount;
+
+			uint32_t maxInterval = simulateColliders ? maxStepIntervalWithColliders : maxStepInterval;
+			uint32_t interval = 1;
+			while (interval < maxInterval && visibility * interval < updateRateLod) interval *= 2;
+			chunk.stepInterval = interval;
+		}
+	}
+
+	// Each step that overruns lodStepBudget raises updateRateLod by a quarter, and each that takes less than three
+	// quarters of it lowers it by a tenth, so the detail follows the load over a few dozen steps without oscillating.
+	void adaptUpdateRateLod(double stepDuration) {
+		const float minLod = 0.05f;
+		if (lodStepBudget <= 0.0f || replayUpdateRateLod) return;
+		float oldLod = updateRateLod;
+
+		if (stepDuration > lodStepBudget) {
+			updateRateLod = updateRateLod < minLod ? minLod : updateRateLod * 1.25f;
+			if (updateRateLod > (float)maxStepInterval) updateRateLod = (float)maxStepInterval;
+		}
+		else if (stepDuration < lodStepBudget * 0.75) {
+			updateRateLod *= 0.9f;
+			if (updateRateLod < minLod) updateRateLod = 0.0f;
+		}
+
+		// The new value is first used by the next step's update pass.
+		if (updateRateLod != oldLod) updateRateLodChanges.push_back({ stepIndex + 1, updateRateLod });
+	}
+
+	// 4096 particles, whose state fits in L2 whatever the layout and precision.
+	const uint32_t updateTaskChunks = 4;
+
+	void updateChunks(uint32_t firstChunk, uint32_t endChunkExclusive) {
+		updateRangeFunction(firstChunk, endChunkExclusive);
+		if (isUpdateRateLodActive()) chooseStepIntervals(firstChunk, endChunkExclusive);
+	}
+
+	void updatePass(uint32_t threadIndex, uint32_t threadCount) {
+		uint32_t firstChunk, endChunkExclusive;
+		findUpdateRange(threadIndex, threadCount, &firstChunk, &endChunkExclusive);
+		runScheduledRange(threadIndex, threadCount, firstChunk, endChunkExclusive, (uint32_t)chunks.size(), updateTaskChunks, updateChunks);
+		if (threadIndex < updateThreadNodes.size()) updateThreadNodes[threadIndex] = findCurrentNode();
+	}
+
+	// The work of one step, divided between threadCount threads. Each pass is finished by every thread before the next
+	// starts, and runPass runs one pass on every thread. In fluid mode the fluid's passes come first, using the grid from
+	// the previous step, and the grid is built by the passes after the update.
+	template<typename RunPassFunction>
+	void runStepPasses(uint32_t threadCount, RunPassFunction runPass, UpdateStats &stats) {
+		prepareTaskDeques(threadCount);
+		if (simulationMode == SimulationMode::procedural) return;
+		bool fluid = simulationMode == SimulationMode::fluid;
+
+		if (fluid) {
+			double fluidStartTime = getTime();
+			prepareFluid();
+
+			if (gridIsCurrent) {
+				runPass(gatherFluidPass);
+				runPass(findFluidDensitiesPass);
+				runPass(findFluidAccelerationsPass);
+			}
+			else clearFluidAccelerations();
+
+			stats.fluidTime = getTime() - fluidStartTime;
+		}
+
+		runPass(updatePass);
+
+		// Morton order only follows the particles' positions where they are stored, which they aren't in analytic mode.
+		if (isReorderStep()) {
+			double reorderStartTime = getTime();
+			reorderParticles(threadCount, runPass);
+			stats.reorderTime = getTime() - reorderStartTime;
+		}
+
+		// The update has moved the particles, so the grid has to be built again before it is used. The analytic mode
+		// doesn't store the positions, so it has no grid.
+		gridIsCurrent = false;
+		if ((!enableGrid && !fluid) || simulationMode == SimulationMode::analytic) return;
+
+		double gridStartTime = getTime();
+		prepareGrid(threadCount);
+		runPass(countGridBucketsPass);
+		runPass(sumGridBlockPass);
+
+		uint32_t start = 0;
+		for (auto &blockStart : gridBlockStarts) {
+			uint32_t sum = blockStart;
+			blockStart = start;
+			start += sum;
+		}
+		gridBucketStarts[gridBucketCount] = start;
+
+		runPass(findGridBucketStartsPass);
+		runPass(scatterGridParticlesPass);
+		gridIsCurrent = true;
+
+		stats.gridBuildTime = getTime() - gridStartTime;
+	}
+
+	void updaterThread(uint32_t threadIndex) {
+		uint32_t sense = 0;
+		WakeLatencies &latencies = updaterWakeLatencies[threadIndex];
+		if (enableNumaPlacement) pinThread(threadIndex, updaterBarrier.participantCount);
+
+		while (true) {
+			arriveAtBarrier(updaterBarrier, sense);
+			if (updaterThreadsShouldReturn) break;
+
+			double latency = getTime() - passStartTime;
+			latencies.total += latency;
+			if (latency > latencies.worst) latencies.worst = latency;
+			latencies.count++;
+
+			updaterPass(threadIndex, updaterBarrier.participantCount);
+
+			arriveAtBarrier(updaterBarrier, sense);
+		}
+	}
+
+	// Finds the vectors that span the emitter's velocity cone, for spawnRangeWith().
+	void findConeAxes(const Emitter &emitter, vec3 *tangent, vec3 *bitangent) {
+		float speed = length(emitter.velocity);
+
+		if (speed == 0.0f) {
+			*tangent = *bitangent = vec3(0);
+			return;
+		}
+
+		vec3 axis = emitter.velocity / speed;
+		vec3 reference = fabsf(axis.y) < 0.9f ? vec3(0, 1, 0) : vec3(1, 0, 0);
+		float radius = speed * tanf(emitter.coneAngle);
+
+		*tangent = normalize(cross(axis, reference));
+		*bitangent = cross(axis, *tangent) * radius;
+		*tangent *= radius;
+	}
+
+	// Procedural mode's particles are evaluated by procedural.vert, or by findProceduralParticle() with
+	// evaluateProceduralOnCpu. Where the two differ the shader is wrong, as the CPU's evaluation reuses the random
+	// numbers and ballistic path of the other modes. A particle that reaches the ground is hidden until its next spawn,
+	// rather than freeing its slot for another as in the other modes.
+	bool evaluateProceduralOnCpu = false;
+
+	// The real time the frame is drawn at. With a fixed timestep it is ahead of the last step by the unsimulated time.
+	double findRenderTime() {
+		return elapsedTime + (enableFixedTimestep ? unsimulatedTime : 0.0);
+	}
+
+	// procedural.vert's push constants for an emitter at time. The phase within the current period is found in doubles,
+	// so that the floats the shader works with stay precise however long the application runs.
+	graphics::ProceduralEmitter findProceduralEmitter(uint32_t emitterIndex, double time) {
+		const Emitter &emitter = emitterRanges[emitterIndex].emitter;
+
+		graphics::ProceduralEmitter values = {};
+		if (emitter.rate <= 0.0f || emitter.budget == 0) return values;
+
+		vec3 coneTangent, coneBitangent;
+		findConeAxes(emitter, &coneTangent, &coneBitangent);
+
+		double period = emitter.budget / (double)emitter.rate;
+		double cycles = floor(time / period);
+
+		values.positionAndLifetime = vec4(emitter.position, emitter.lifetime);
+		values.velocityAndSpawnInterval = vec4(emitter.velocity, 1.0f / emitter.rate);
+		values.coneTangentAndPeriod = vec4(coneTangent, (float)period);
+		values.coneBitangentAndPhase = vec4(coneBitangent, (float)(time - cycles * period));
+		values.gravityAndDrag = vec4(forceSettings.gravity, forceSettings.linearDrag);
+
+		uint64_t splitMixState = randomSeed ^ ((emitterIndex + 1) * 0x9E3779B97F4A7C15ull);
+		for (auto &key : values.drawKeys) key = (uint32_t)splitMix64(splitMixState);
+
+		values.cycle = (int32_t)cycles;
+		values.groundLevel = groundLevel;
+		values.simulationSpeed = simulationSpeed;
+		values.particleCount = emitter.budget;
+		return values;
+	}
+
+	// Evaluates the emitter's particle as procedural.vert does, returning whether it is live.
+	bool findProceduralParticle(const graphics::ProceduralEmitter &emitter, uint32_t particle, vec3 *position, float *particleBrightness) {
+		float particleAge = emitter.coneBitangentAndPhase.w - (float)particle * emitter.velocityAndSpawnInterval.w;
+		int32_t cycle = emitter.cycle;
+		if (particleAge < 0.0f) {
+			particleAge += emitter.coneTangentAndPeriod.w;
+			cycle--;
+		}
+
+		// Each spawn of the particle draws with its own keys.
+		RandomGenerator<simd::Scalar> rng(0);
+		for (int d = 0; d < randomDrawsPerSpawn; d++) rng.drawKeys[d] = emitter.drawKeys[d] ^ ((uint32_t)cycle * 0xD1B54A33u);
+
+		float discX = rng.nextFloats(particle, 1) - 0.5f;
+		float discY = rng.nextFloats(particle, 2) - 0.5f;
+		float scale = sqrtf(rng.nextFloats(particle, 3) / fmaxf(discX * discX + discY * discY, 1e-12f));
+		vec3 velocity = vec3(emitter.velocityAndSpawnInterval)
+			+ vec3(emitter.coneTangentAndPeriod) * (discX * scale) + vec3(emitter.coneBitangentAndPhase) * (discY * scale);
+
+		const BallisticPath<simd::Scalar> path;
+		float perVelocity, perGravity, decay;
+		path.findDistances(particleAge, perVelocity, perGravity, decay);
+
+		*position = vec3(emitter.positionAndLifetime) + velocity * perVelocity + vec3(emitter.gravityAndDrag) * perGravity;
+		*particleBrightness = rng.nextFloats(particle, 0);
+
+		return cycle >= 0 && particleAge < emitter.positionAndLifetime.w && position->y <= emitter.groundLevel;
+	}
+
+	// Finds the procedural particle at particleIndex in the emitters' ranges, returning whether it is live.
+	bool findProceduralParticleAtIndex(uint32_t particleIndex, vec3 *position) {
+		for (uint32_t e = 0; e < emitterRanges.size(); e++) {
+			const EmitterRange &range = emitterRanges[e];
+			if (particleIndex < range.firstParticle || particleIndex >= range.firstParticle + range.emitter.budget) continue;
+
+			graphics::ProceduralEmitter emitter = findProceduralEmitter(e, findRenderTime());
+			float particleBrightness;
+			return particleIndex - range.firstParticle < emitter.particleCount
+				&& findProceduralParticle(emitter, particleIndex - range.firstParticle, position, &particleBrightness);
+		}
+
+		*position = vec3(0);
+		return false;
+	}
+
+	// Sets up the spawning and the division of the chunks between threads for updateRange(). Each emitter spawns into
+	// the free slots at the ends of its chunks, filling the first chunks first, as long as it is below its budget.
+	UpdateStats prepareStep(float deltaTime) {
+		stepSize = deltaTime * simulationSpeed;
+		stepIndex++;
+
+		while (replayUpdateRateLod && replayedLodChanges < updateRateLodChanges.size()
+			&& updateRateLodChanges[replayedLodChanges].step <= stepIndex) {
+			updateRateLod = updateRateLodChanges[replayedLodChanges++].updateRateLod;
+		}
+		simulatedTime += stepSize;
+		elapsedTime += deltaTime;
+
+		// Procedural particles are found from the time alone, so only it advances.
+		UpdateStats stats = {};
+		if (simulationMode == SimulationMode::procedural) return stats;
+
+		emitterSpawnValues.resize(emitterRanges.size());
+
+		for (uint32_t e = 0; e < emitterRanges.size(); e++) {
+			EmitterRange &range = emitterRanges[e];
+			const Emitter &emitter = range.emitter;
+
+			SpawnValues &values = emitterSpawnValues[e];
+			values.position = emitter.position;
+			values.velocity = emitter.velocity;
+			values.lifetime = emitter.lifetime;
+			findConeAxes(emitter, &values.coneTangent, &values.coneBitangent);
+
+			// Particles the emitter has no room for are dropped rather than spawned later.
+			range.spawnsOwed += (double)emitter.rate * deltaTime;
+			uint32_t spawnsRemaining = range.spawnsOwed < emitter.budget ? (uint32_t)range.spawnsOwed : emitter.budget;
+			range.spawnsOwed -= (uint32_t)range.spawnsOwed;
+
+			for (uint32_t c = range.firstChunk; c < range.firstChunk + range.chunkCount; c++) {
+				Chunk &chunk = chunks[c];
+				uint32_t freeSlots = chunk.size - chunk.liveCount;
+				chunk.spawnCount = spawnsRemaining < freeSlots ? spawnsRemaining : freeSlots;
+				spawnsRemaining -= chunk.spawnCount;
+
+				if (chunk.spawnCount > 0) {
+					stats.spawnBatches++;
+					stats.spawnedParticles += chunk.spawnCount;
+				}
+			}
+		}
+
+		// A chunk skips the step unless its tier is due, staggered by its index so that the tiers' updates are spread
+		// over their intervals. Chunks spawning are always updated, so that their skipped time is only applied to the
+		// particles that lived through it, and every chunk is brought up to date before reordering mixes them.
+		bool lod = isUpdateRateLodActive();
+		bool reordering = isReorderStep();
+
+		for (uint32_t c = 0; c < chunks.size(); c++) {
+			Chunk &chunk = chunks[c];
+			if (!lod) chunk.stepInterval = 1;
+			chunk.stepping = chunk.spawnCount > 0 || reordering || (stepIndex + c) % chunk.stepInterval == 0;
+
+			if (chunk.stepping) {
+				chunk.stepTime = chunk.skippedTime + deltaTime;
+				chunk.skippedTime = 0.0f;
+			}
+			else {
+				chunk.skippedTime += deltaTime;
+				stats.deferredParticles += chunk.liveCount;
+			}
+		}
+
+		// Skipped chunks are no work, except in analytic mode, which visits every chunk to find the dying particles.
+		bool analytic = simulationMode == SimulationMode::analytic;
+		chunkWorkStarts.resize(chunks.size() + 1);
+		chunkWorkStarts[0] = 0;
+
+		for (uint32_t c = 0; c < chunks.size(); c++) {
+			uint32_t liveWork = chunks[c].stepping || analytic ? chunks[c].liveCount : 0;
+			chunkWorkStarts[c + 1] = chunkWorkStarts[c] + liveWork + chunks[c].spawnCount;
+		}
+
+		return stats;
+	}
+
+	// The particles are divided into rangeCount ranges the same way they are divided between the updater threads.
+	UpdateStats simulateOnCallingThread(float deltaTime, uint32_t rangeCount) {
+		double startTime = getTime();
+		UpdateStats stats = prepareStep(deltaTime);
+
+		runStepPasses(rangeCount, [rangeCount](UpdaterPass pass) {
+			for (uint32_t r = 0; r < rangeCount; r++) pass(r, rangeCount);
+		}, stats);
+
+		findSchedulingStats(rangeCount, stats);
+
+		adaptUpdateRateLod(getTime() - startTime);
+		return stats;
+	}
+
+	// FNV-1a over every attribute of every live particle, in particle order so that it is independent of the layout.
+	uint64_t stateChecksum() {
+		uint64_t hash = 0xCBF29CE484222325ull;
+
+		for (auto &chunk : chunks) {
+			for (uint32_t i = chunk.firstParticle; i < chunk.firstParticle + chunk.liveCount; i++) {
+				for (int a = 0; a < attributeCount; a++) {
+					float value = getAttribute((Attribute)a, i);
+					uint32_t bits;
+					memcpy(&bits, &value, sizeof(bits));
+					hash = (hash ^ bits) * 0x100000001B3ull;
+				}
+			}
+		}
+
+		return hash;
+	}
+
+	vec3 getParticlePosition(uint32_t particleIndex) {
+		if (simulationMode == SimulationMode::procedural) {
+			vec3 position;
+			findProceduralParticleAtIndex(particleIndex, &position);
+			return position;
+		}
+
+		vec3 position(getAttribute(positionX, particleIndex), getAttribute(positionY, particleIndex), getAttribute(positionZ, particleIndex));
+		if (simulationMode != SimulationMode::analytic) return position;
+
+		const BallisticPath<simd::Scalar> path;
+		float perVelocity, perGravity, decay;
+		path.findDistances((float)elapsedTime - getAttribute(age, particleIndex), perVelocity, perGravity, decay);
+
+		vec3 velocity(getAttribute(velocityX, particleIndex), getAttribute(velocityY, particleIndex), getAttribute(velocityZ, particleIndex));
+		return position + velocity * perVelocity + forceSettings.gravity * perGravity;
+	}
+
+	double simulateGridCacheMisses() {
+		if (!gridIsCurrent) return 0.0;
+
+		// Each set's lines are kept with the most recently used first, and the least recently used is evicted.
+		const uint32_t ways = 8;
+		const uint32_t setCount = 32768 / 64 / ways;
+		uintptr_t cachedLines[setCount][ways];
+		for (auto &set : cachedLines) for (auto &line : set) line = UINTPTR_MAX;
+
+		uint32_t particlesInGrid = gridBucketStarts[gridBucketCount];
+		uint64_t missCount = 0;
+
+		for (uint32_t slot = 0; slot < particlesInGrid; slot++) {
+			for (int a = positionX; a <= positionZ; a++) {
+				uintptr_t line = (uintptr_t)findAttribute((Attribute)a, gridParticles[slot]) / 64;
+				uintptr_t *set = cachedLines[line % setCount];
+
+				uint32_t way = 0;
+				while (way < ways - 1 && set[way] != line) way++;
+				if (set[way] != line) missCount++;
+
+				for (; way > 0; way--) set[way] = set[way - 1];
+				set[0] = line;
+			}
+		}
+
+		return particlesInGrid > 0 ? (double)missCount / particlesInGrid : 0.0;
+	}
+
+	// The nodes the pages at addresses are on, or -1 for pages that haven't been touched.
+	void findPageNodes(vector<void*> &pages, vector<int> &nodes) {
+		nodes.assign(pages.size(), -1);
+		if (pages.empty()) return;
+
+#ifdef _WIN32
+		vector<PSAPI_WORKING_SET_EX_INFORMATION> entries(pages.size());
+		for (size_t i = 0; i < pages.size(); i++) entries[i].VirtualAddress = pages[i];
+		if (!QueryWorkingSetEx(GetCurrentProcess(), entries.data(), (DWORD)(entries.size() * sizeof(entries[0])))) return;
+
+		for (size_t i = 0; i < pages.size(); i++) {
+			if (entries[i].VirtualAttributes.Valid) nodes[i] = (int)entries[i].VirtualAttributes.Node;
+		}
+#else
+		// move_pages() without target nodes only reports where the pages are.
+		if (syscall(SYS_move_pages, 0, pages.size(), pages.data(), nullptr, nodes.data(), 0) != 0) nodes.assign(pages.size(), -1);
+#endif
+	}
+
+	double findRemoteStateFraction() {
+		if (steppingThreadCount == 0 || chunkWorkStarts.size() != chunks.size() + 1) return 0.0;
+
+#ifdef _WIN32
+		SYSTEM_INFO systemInfo;
+		GetSystemInfo(&systemInfo);
+		uintptr_t pageSize = systemInfo.dwPageSize;
+#else
+		uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+#endif
+
+		uint64_t pageCount = 0, remotePageCount = 0;
+
+		for (uint32_t t = 0; t < steppingThreadCount; t++) {
+			uint32_t firstChunk, endChunkExclusive;
+			findUpdateRange(t, steppingThreadCount, &firstChunk, &endChunkExclusive);
+			if (firstChunk >= endChunkExclusive) continue;
+
+			uint32_t firstParticle = chunks[firstChunk].firstParticle;
+			uint32_t lastParticle = chunks[endChunkExclusive - 1].firstParticle + chunks[endChunkExclusive - 1].size - 1;
+
+			// Every page any of the range's attributes is on. In AoSoA the attributes share their pages.
+			vector<void*> pages;
+
+			for (int a = 0; a < attributeCount; a++) {
+				uintptr_t first = (uintptr_t)findAttribute((Attribute)a, firstParticle) / pageSize;
+				uintptr_t last = ((uintptr_t)findAttribute((Attribute)a, lastParticle) + attributeSize((Attribute)a) - 1) / pageSize;
+				for (uintptr_t page = first; page <= last; page++) pages.push_back((void*)(page * pageSize));
+			}
+
+			sort(pages.begin(), pages.end());
+			pages.erase(unique(pages.begin(), pages.end()), pages.end());
+
+			vector<int> nodes;
+			findPageNodes(pages, nodes);
+
+			for (auto node : nodes) {
+				if (node < 0) continue;
+				pageCount++;
+				if ((uint32_t)node != updateThreadNodes[t]) remotePageCount++;
+			}
+		}
+
+		return pageCount > 0 ? (double)remotePageCount / pageCount : 0.0;
+	}
+
+	bool isParticleLive(uint32_t particleIndex) {
+		if (simulationMode == SimulationMode::procedural) {
+			vec3 position;
+			return findProceduralParticleAtIndex(particleIndex, &position);
+		}
+
+		auto chunk = upper_bound(chunks.begin(), chunks.end(), particleIndex,
+			[](uint32_t index, const Chunk &chunk) { return index < chunk.firstParticle; });
+		if (chunk == chunks.begin()) return false;
+
+		chunk--;
+		return particleIndex < chunk->firstParticle + chunk->liveCount;
+	}
+
+	void runUpdaterPass(UpdaterPass pass) {
+		updaterPass = pass;
+		passStartTime = getTime();
+
+		// The first barrier starts the pass, and the second waits for the updater threads to finish their share of it.
+		arriveAtBarrier(updaterBarrier, steppingThreadSense);
+		pass(0, steppingThreadCount);
+		arriveAtBarrier(updaterBarrier, steppingThreadSense);
+	}
+
+	UpdateStats step(float deltaTime) {
+		double startTime = getTime();
+		UpdateStats stats = prepareStep(deltaTime);
+
+		runStepPasses(steppingThreadCount, runUpdaterPass, stats);
+
+		// Every updater thread has finished the step, so their latencies can be read and reset.
+		double totalWakeLatency = 0.0;
+		uint32_t wakeCount = 0;
+
+		for (auto &latencies : updaterWakeLatencies) {
+			totalWakeLatency += latencies.total;
+			wakeCount += latencies.count;
+			if (latencies.worst > stats.worstWakeLatency) stats.worstWakeLatency = latencies.worst;
+			latencies = WakeLatencies();
+		}
+
+		if (wakeCount > 0) stats.meanWakeLatency = totalWakeLatency / wakeCount;
+		findSchedulingStats(steppingThreadCount, stats);
+
+		lastUpdateGridBuildTime += stats.gridBuildTime;
+		adaptUpdateRateLod(getTime() - startTime);
+		return stats;
+	}
+
+	UpdateStats simulateOnUpdaterThreads(float deltaTime) {
+		return step(deltaTime);
+	}
+
+	// One frame's simulation: a step of deltaTime, or with a fixed timestep as many fixed steps as fit in the time.
+	void advance(float deltaTime) {
+		lastUpdateGridBuildTime = 0.0;
+
+		if (!enableFixedTimestep) {
+			step(deltaTime);
+			return;
+		}
+
+		unsimulatedTime += deltaTime;
+		double startTime = getTime();
+
+		for (int i = 0; i < maxStepsPerUpdate && unsimulatedTime >= fixedStepDuration; i++) {
+			if (i > 0 && getTime() - startTime > maxUpdateDuration) break;
+			step(fixedStepDuration);
+			unsimulatedTime -= fixedStepDuration;
+		}
+
+		if (unsimulatedTime >= fixedStepDuration) unsimulatedTime = fmod(unsimulatedTime, (double)fixedStepDuration);
+	}
+
+	// Evaluates the live procedural particles on the CPU into the arrays render() draws from.
+	uint32_t prepareProceduralParticles() {
+		double renderTime = findRenderTime();
+		uint32_t liveCount = 0;
+
+		for (uint32_t e = 0; e < emitterRanges.size(); e++) {
+			graphics::ProceduralEmitter emitter = findProceduralEmitter(e, renderTime);
+
+			for (uint32_t i = 0; i < emitter.particleCount; i++) {
+				vec3 position;
+				float particleBrightness;
+				if (!findProceduralParticle(emitter, i, &position, &particleBrightness)) continue;
+
+				for (int c = 0; c < 3; c++) renderableComponents[c][liveCount] = position[c];
+				renderableComponents[3][liveCount] = particleBrightness;
+				liveCount++;
+			}
+		}
+
+		return liveCount;
+	}
+
+	uint32_t prepareRenderableParticles() {
+		// With a fixed timestep the state usually lags real time by a fraction of a step. The rendered positions are
+		// moved on along their velocities and gravity to cover it, those of chunks the update-rate LOD skipped by the
+		// skipped steps too, and then put back out of the colliders. The analytic mode evaluates them at the time itself.
+		float extrapolationTime = enableFixedTimestep ? (float)unsimulatedTime * simulationSpeed : 0.0f;
+		bool analytic = simulationMode == SimulationMode::analytic;
+		bool extrapolated = false;
+		float renderTime = (float)findRenderTime();
+		float gravity[3] = { forceSettings.gravity.x, forceSettings.gravity.y, forceSettings.gravity.z };
+
+		// Each block of particles has its components contiguous
+		uint32_t blockSize = blockSizeOfLayout(layout);
+
+		// Sized here rather than by initSimulation(), so that benchmarks without graphics don't allocate them.
+		for (auto &component : renderableComponents) {
+			if (component.size() < particleCapacity) component.resize(particleCapacity);
+		}
+
+		if (simulationMode == SimulationMode::procedural) return prepareProceduralParticles();
+
+		// The live particles at the front of each chunk are gathered into dense arrays for the vertex buffers, converting
+		// half precision brightness. Whole blocks are copied, so a chunk may write past its live particles, but the next
+		// chunk overwrites that, and the copies never pass particleCapacity because chunks are only ever packed closer.
+		Attribute positionAttributes[] = { positionX, positionY, positionZ };
+		Attribute velocityAttributes[] = { velocityX, velocityY, velocityZ };
+		float velocities[simd::maxWidth];
+		uint32_t liveCount = 0;
+
+		for (auto &chunk : chunks) {
+			float chunkExtrapolationTime = extrapolationTime + chunk.skippedTime * simulationSpeed;
+			extrapolated |= chunkExtrapolationTime > 0.0f && chunk.liveCount > 0 && !analytic;
+
+			if (analytic && chunk.liveCount > 0) {
+				evaluatePositionsFunction(chunk.firstParticle, chunk.liveCount, renderTime,
+					&renderableComponents[0][liveCount], &renderableComponents[1][liveCount], &renderableComponents[2][liveCount]);
+			}
+
+			for (uint32_t i = 0; i < chunk.liveCount; i += blockSize) {
+				uint32_t particle = chunk.firstParticle + i;
+
+				for (int c = 0; c < 3 && !analytic; c++) {
+					float *destination = &renderableComponents[c][liveCount + i];
+					const float *positions = (const float*)findAttribute(positionAttributes[c], particle);
+
+					if (chunkExtrapolationTime > 0.0f) {
+						float fall = 0.5f * gravity[c] * chunkExtrapolationTime * chunkExtrapolationTime;
+						copyAttributeAsFloats(velocityAttributes[c], particle, blockSize, velocities);
+						for (uint32_t j = 0; j < blockSize; j++) destination[j] = positions[j] + velocities[j] * chunkExtrapolationTime + fall;
+					}
+					else memcpy(destination, positions, sizeof(float) * blockSize);
+				}
+
+				copyAttributeAsFloats(brightness, particle, blockSize, &renderableComponents[3][liveCount + i]);
+			}
+
+			liveCount += chunk.liveCount;
+		}
+
+		if (extrapolated) {
+			bool collide = simulationMode == SimulationMode::fluid || simulateColliders;
+			constrainPositionsFunction(liveCount, collide, renderableComponents[0].data(), renderableComponents[1].data(), renderableComponents[2].data());
+		}
+
+		return liveCount;
+	}
+
+	void findProceduralEmitters(vector<graphics::ProceduralEmitter> &emitters) {
+		double renderTime = findRenderTime();
+		emitters.clear();
+		for (uint32_t e = 0; e < emitterRanges.size(); e++) emitters.push_back(findProceduralEmitter(e, renderTime));
+	}
+
+	// Pipelining. With pipelineDepth above 0, the simulation runs on a thread of its own and update() queues frames for
+	// it, so that simulating the next frames overlaps drawing this one, for pipelineDepth frames of latency. It is off
+	// by default, as the overlap has not been measured on a GPU yet.
+	uint32_t pipelineDepth = 0;
+
+	struct RenderableFrame {
+		vector<float> components[4]; // x, y, z, brightness
+		uint32_t liveCount;
+		uint32_t particleCapacity;
+		bool procedural; // Drawn by procedural.vert from emitters, rather than from the components
+		vector<graphics::ProceduralEmitter> emitters;
+		double gridBuildTime;
+	};
+
+	struct FrameJob {
+		float deltaTime;
+		vector<function<void()>> changes; // Run before the frame is simulated
+	};
+
+	// Everything below but pendingChanges and the drawn frame is guarded by pipelineMutex. The frames in flight are
+	// those queued or being simulated, which stay in frameJobs until they finish, and those finished but not drawn.
+	mutex pipelineMutex;
+	condition_variable pipelineCondition;
+	deque<FrameJob> frameJobs;
+	deque<RenderableFrame> finishedFrames;
+	vector<RenderableFrame> spareFrames;
+	thread simulationThread;
+	bool simulationThreadShouldReturn = false;
+
+	// Changes made on the calling thread since the last update(), and the frame last drawn, which is drawn again until
+	// the next is due.
+	vector<function<void()>> pendingChanges;
+	RenderableFrame drawnFrame;
+	bool hasDrawnFrame = false;
+	double renderedGridBuildTime = 0.0;
+
+	uint32_t findFramesInFlight() {
+		return (uint32_t)(frameJobs.size() + finishedFrames.size());
+	}
+
+	// The render thread keeps a core of its own, so that the updater threads' barriers never wait for a thread it preempted.
+	uint32_t findUpdaterThreadCount() {
+		uint32_t hardwareThreads = thread::hardware_concurrency();
+		if (pipelineDepth > 0 && hardwareThreads > 1) hardwareThreads--;
+		return hardwareThreads;
+	}
+
+	void prepareRenderableFrame(RenderableFrame &frame) {
+		frame.procedural = simulationMode == SimulationMode::procedural && !evaluateProceduralOnCpu;
+		frame.particleCapacity = particleCapacity;
+		frame.gridBuildTime = lastUpdateGridBuildTime;
+		frame.liveCount = 0;
+
+		if (frame.procedural) findProceduralEmitters(frame.emitters);
+		else {
+			frame.liveCount = prepareRenderableParticles();
+			for (int c = 0; c < 4; c++) frame.components[c].swap(renderableComponents[c]);
+		}
+	}
+
+	void simulationThreadMain() {
+		startUpdaterThreads(findUpdaterThreadCount());
+		unique_lock<mutex> lock(pipelineMutex);
+
+		while (true) {
+			pipelineCondition.wait(lock, [] { return simulationThreadShouldReturn || !frameJobs.empty(); });
+			if (frameJobs.empty()) break;
+
+			// The job stays queued while it is simulated, so that update() counts it as in flight.
+			FrameJob &job = frameJobs.front();
+			RenderableFrame frame;
+			if (!spareFrames.empty()) {
+				frame = move(spareFrames.back());
+				spareFrames.pop_back();
+			}
+
+			lock.unlock();
+			for (auto &change : job.changes) change();
+			advance(job.deltaTime);
+			prepareRenderableFrame(frame);
+			lock.lock();
+
+			frameJobs.pop_front();
+			finishedFrames.push_back(move(frame));
+			pipelineCondition.notify_all();
+		}
+
+		lock.unlock();
+		stopUpdaterThreads();
+	}
+
+	// Starts the updater threads on the calling thread, or the simulation thread that starts them on itself.
+	void startSimulation() {
+		if (pipelineDepth == 0) {
+			startUpdaterThreads(findUpdaterThreadCount());
+			return;
+		}
+
+		simulationThreadShouldReturn = false;
+		simulationThread = thread(simulationThreadMain);
+	}
+
+	// Returns once every queued frame has been simulated and the updater threads have stopped. Frames not yet drawn are
+	// dropped, and the changes not yet queued are made on the calling thread, which owns the simulation afterwards.
+	void stopSimulation() {
+		if (simulationThread.joinable()) {
+			{
+				lock_guard<mutex> lock(pipelineMutex);
+				simulationThreadShouldReturn = true;
+			}
+
+			pipelineCondition.notify_all();
+			simulationThread.join();
+
+			while (!finishedFrames.empty()) {
+				spareFrames.push_back(move(finishedFrames.front()));
+				finishedFrames.pop_front();
+			}
+
+			if (hasDrawnFrame) spareFrames.push_back(move(drawnFrame));
+			hasDrawnFrame = false;
+		}
+		else stopUpdaterThreads();
+
+		for (auto &change : pendingChanges) change();
+		pendingChanges.clear();
+	}
+
+	// The pipeline is emptied and started again, so that no more frames are in flight than the new depth allows.
+	void setPipelineDepth(uint32_t depth) {
+		if (depth == pipelineDepth) return;
+
+		stopSimulation();
+		pipelineDepth = depth;
+		startSimulation();
+	}
+
+	uint32_t getPipelineDepth() {
+		return pipelineDepth;
+	}
+
+	void enqueueChange(function<void()> change) {
+		if (pipelineDepth > 0) pendingChanges.push_back(move(change));
+		else change();
+	}
+
+	void update(float deltaTime) {
+		if (pipelineDepth == 0) {
+			advance(deltaTime);
+			return;
+		}
+
+		FrameJob job;
+		job.deltaTime = deltaTime;
+		job.changes.swap(pendingChanges);
+
+		// Only more updates than renders fill the pipeline, and then the oldest finished frames are dropped undrawn.
+		unique_lock<mutex> lock(pipelineMutex);
+		pipelineCondition.wait(lock, [] { return findFramesInFlight() <= pipelineDepth || !finishedFrames.empty(); });
+
+		while (findFramesInFlight() > pipelineDepth && !finishedFrames.empty()) {
+			spareFrames.push_back(move(finishedFrames.front()));
+			finishedFrames.pop_front();
+		}
+
+		frameJobs.push_back(move(job));
+		pipelineCondition.notify_all();
+	}
+
+	double getGridBuildTime() {
+		return pipelineDepth > 0 ? renderedGridBuildTime : lastUpdateGridBuildTime;
+	}
+
+	void drawFrame(const RenderableFrame &frame) {
+		if (frame.procedural) {
+			graphics::renderProcedural((uint32_t)frame.emitters.size(), frame.emitters.data());
+			return;
+		}
+
+		float *componentPtrs[4];
+		for (int c = 0; c < 4; c++) componentPtrs[c] = (float*)frame.components[c].data();
+		graphics::render(frame.liveCount, frame.particleCapacity, 4, componentPtrs);
+	}
+
+	// Takes the oldest finished frame once more than pipelineDepth frames are in flight, or the first frame as soon as
+	// it is finished, so that something is drawn from the start, and draws the frame taken last.
+	void renderPipelined() {
+		{
+			unique_lock<mutex> lock(pipelineMutex);
+			uint32_t framesInFlight = findFramesInFlight();
+
+			if (framesInFlight > pipelineDepth || (!hasDrawnFrame && framesInFlight > 0)) {
+				pipelineCondition.wait(lock, [] { return !finishedFrames.empty(); });
+				if (hasDrawnFrame) spareFrames.push_back(move(drawnFrame));
+				drawnFrame = move(finishedFrames.front());
+				finishedFrames.pop_front();
+				hasDrawnFrame = true;
+				pipelineCondition.notify_all();
+			}
+		}
+
+		if (!hasDrawnFrame) return;
+		drawFrame(drawnFrame);
+		renderedGridBuildTime = drawnFrame.gridBuildTime;
+	}
+
+	void render() {
+		if (pipelineDepth > 0) {
+			renderPipelined();
+			return;
+		}
+
+		if (simulationMode == SimulationMode::procedural && !evaluateProceduralOnCpu) {
+			vector<graphics::ProceduralEmitter> emitters;
+			findProceduralEmitters(emitters);
+			graphics::renderProcedural((uint32_t)emitters.size(), emitters.data());
+			return;
+		}
+
+		int componentCount = 4; // x, y, z, brightness
+		float * componentPtrs[4];
+
+		uint32_t liveCount = prepareRenderableParticles();
+		for (int c = 0; c < componentCount; c++) componentPtrs[c] = renderableComponents[c].data();
+		
+		graphics::render(liveCount, particleCapacity, componentCount, componentPtrs);
+	}
+
+	void destroy() {
+		stopSimulation();
+
+		freePages(state, stateBytes);
+		state = nullptr;
+		stateBytes = 0;
+
+		_mm_free(fluidStorage);
+		fluidStorage = nullptr;
+		fluidCapacity = 0;
 
-		CloseHandle(updateStartSemaphore);
-		CloseHandle(updateEndSemaphore);
+		freePages(reorderedState, reorderedStateSize);
+		reorderedState = nullptr;
+		reorderedStateSize = 0;
 	}
 }
 
@@ -0,0 +1,73 @@
+#version 450
+
+// Draws an emitter's particles in procedural mode, with no vertex buffers. Each particle's position is evaluated from
+// its index and the time with the same random numbers and ballistic path as findProceduralParticle() in particles.cpp,
+// which must be kept in step with this.
+
+layout(push_constant) uniform ProceduralEmitter {
+	vec4 positionAndLifetime;
+	vec4 velocityAndSpawnInterval;
+	vec4 coneTangentAndPeriod;
+	vec4 coneBitangentAndPhase;
+	vec4 gravityAndDrag;
+	uvec4 drawKeys;
+	int cycle;
+	float groundLevel;
+	float simulationSpeed;
+	uint particleCount;
+} emitter;
+
+layout(location = 0) out vec3 fragmentColor;
+
+// RandomGenerator::nextFloats() for one particle: the MurmurHash3 finalizer of the index and the draw's key,
+// with its top 23 bits as the mantissa of a float in the range 0.0-1.0 (exclusive of 1.0).
+float randomFloat(uint particle, uint key) {
+	uint bits = particle * 0x9E3779B9u + key;
+	bits ^= bits >> 16;
+	bits *= 0x85EBCA6Bu;
+	bits ^= bits >> 13;
+	bits *= 0xC2B2AE35u;
+	bits ^= bits >> 16;
+	return uintBitsToFloat((bits >> 9) | 0x3F800000u) - 1.0;
+}
+
+void main() {
+	uint particle = uint(gl_VertexIndex);
+
+	// The time since the particle last spawned, and how many times it had spawned before that
+	float age = emitter.coneBitangentAndPhase.w - float(particle) * emitter.velocityAndSpawnInterval.w;
+	int cycle = emitter.cycle;
+	if (age < 0) {
+		age += emitter.coneTangentAndPeriod.w;
+		cycle--;
+	}
+
+	uint keyOffset = uint(cycle) * 0xD1B54A33u;
+	float brightness = randomFloat(particle, emitter.drawKeys.x ^ keyOffset);
+
+	// A random point in the disc at the end of the velocity, as in spawnRangeWith()
+	float discX = randomFloat(particle, emitter.drawKeys.y ^ keyOffset) - 0.5;
+	float discY = randomFloat(particle, emitter.drawKeys.z ^ keyOffset) - 0.5;
+	float scale = sqrt(randomFloat(particle, emitter.drawKeys.w ^ keyOffset) / max(discX*discX + discY*discY, 1e-12));
+	vec3 velocity = emitter.velocityAndSpawnInterval.xyz
+		+ emitter.coneTangentAndPeriod.xyz * (discX * scale) + emitter.coneBitangentAndPhase.xyz * (discY * scale);
+
+	// BallisticPath::findDistances()
+	float time = age * emitter.simulationSpeed;
+	float kt = emitter.gravityAndDrag.w * time;
+	float h = (((kt * (1.0 / 720.0) - 1.0 / 120.0) * kt + 1.0 / 24.0) * kt - 1.0 / 6.0) * kt + 0.5;
+	if (kt > 0.1) h = (kt - 1 + exp(-kt)) / (kt * kt);
+
+	vec3 position = emitter.positionAndLifetime.xyz + velocity * (time - time * kt * h) + emitter.gravityAndDrag.xyz * (time * time * h);
+
+	gl_PointSize = 2;
+
+	// Particles that haven't spawned yet, have outlived their lifetime or are below the ground are put beyond the far
+	// plane, where they are clipped.
+	bool live = cycle >= 0 && age < emitter.positionAndLifetime.w && position.y <= emitter.groundLevel;
+	gl_Position = live ? vec4(position, 1.0) : vec4(0.0, 0.0, 2.0, 1.0);
+
+	// As basic.vert
+	float depthDarkening = (1 - position.z*position.z) * 1.1;
+	fragmentColor = vec3(brightness, brightness, 1) * depthDarkening;
+}
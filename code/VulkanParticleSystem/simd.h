@@ -0,0 +1,513 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+// GCC 12's AVX-512 intrinsics pass themselves an undefined vector that -Wuninitialized takes for a bug
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+#else
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+// GCC and Clang only allow intrinsics in functions compiled for their instruction set, so every function
+// using them is tagged with its target. Kernels are tagged with SIMD_KERNEL_*, which also inlines everything
+// they call so that the untagged templates between a kernel and its intrinsics are compiled for that target.
+// MSVC allows any intrinsic anywhere, so these are empty there.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define SIMD_TARGET_SSE4
+#define SIMD_TARGET_AVX2
+#define SIMD_TARGET_AVX512
+#define SIMD_KERNEL_SCALAR
+#define SIMD_KERNEL_SSE4
+#define SIMD_KERNEL_AVX2
+#define SIMD_KERNEL_AVX512
+#else
+#define SIMD_TARGET_SSE4 __attribute__((target("sse4.1")))
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2,fma,f16c")))
+#define SIMD_TARGET_AVX512 __attribute__((target("avx512f,avx2,fma,f16c")))
+#define SIMD_KERNEL_SCALAR __attribute__((flatten))
+#define SIMD_KERNEL_SSE4 __attribute__((target("sse4.1"), flatten))
+#define SIMD_KERNEL_AVX2 __attribute__((target("avx2,fma,f16c"), flatten))
+#define SIMD_KERNEL_AVX512 __attribute__((target("avx512f,avx2,fma,f16c"), flatten))
+
+// The untagged templates that return vectors are only ever inlined into kernels, so their ABI never applies. Vectors
+// are passed to them by reference, since GCC's note on passing them by value can't be silenced.
+#if !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+#endif
+
+namespace simd {
+
+	// The widest vector any of the instruction sets below uses, in floats.
+	const uint32_t maxWidth = 16;
+
+	// Ordered from least to most capable, so levels can be compared.
+	enum class Level { scalar, sse4, avx2, avx512 };
+
+	inline const char *levelName(Level level) {
+		switch (level) {
+		case Level::sse4: return "SSE4.1";
+		case Level::avx2: return "AVX2+FMA";
+		case Level::avx512: return "AVX-512F";
+		default: return "scalar";
+		}
+	}
+
+	inline uint32_t levelWidth(Level level) {
+		switch (level) {
+		case Level::sse4: return 4;
+		case Level::avx2: return 8;
+		case Level::avx512: return 16;
+		default: return 1;
+		}
+	}
+
+	inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t registers[4]) {
+#if defined(_MSC_VER)
+		__cpuidex((int*)registers, (int)leaf, (int)subleaf);
+#else
+		__cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+	}
+
+	// The register state the OS saves on context switches. AVX and AVX-512 are unusable unless it includes their registers.
+	inline uint64_t osSavedRegisterState() {
+#if defined(_MSC_VER)
+		return _xgetbv(0);
+#else
+		uint32_t low, high;
+		__asm__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+		return ((uint64_t)high << 32) | low;
+#endif
+	}
+
+	// The most capable level supported by both the CPU and the OS.
+	inline Level detectLevel() {
+		uint32_t leaf1[4], leaf7[4];
+		cpuid(0, 0, leaf1);
+		uint32_t maxLeaf = leaf1[0];
+
+		cpuid(1, 0, leaf1);
+		bool hasSse41 = (leaf1[2] & (1 << 19)) != 0;
+		bool hasFma = (leaf1[2] & (1 << 12)) != 0;
+		bool hasOsxsave = (leaf1[2] & (1 << 27)) != 0;
+		bool hasAvx = (leaf1[2] & (1 << 28)) != 0;
+		bool hasF16c = (leaf1[2] & (1 << 29)) != 0;
+
+		if (!hasSse41) return Level::scalar;
+		if (maxLeaf < 7 || !hasOsxsave || !hasAvx) return Level::sse4;
+
+		uint64_t savedState = osSavedRegisterState();
+		bool osSavesAvx = (savedState & 0x6) == 0x6; // XMM and YMM
+		bool osSavesAvx512 = (savedState & 0xE6) == 0xE6; // XMM, YMM, opmask and ZMM
+
+		cpuid(7, 0, leaf7);
+		bool hasAvx2 = (leaf7[1] & (1 << 5)) != 0;
+		bool hasAvx512f = (leaf7[1] & (1 << 16)) != 0;
+
+		if (!osSavesAvx || !hasAvx2 || !hasFma || !hasF16c) return Level::sse4;
+		if (!osSavesAvx512 || !hasAvx512f) return Level::avx2;
+		return Level::avx512;
+	}
+
+	// The size of the largest data cache, from the deterministic cache parameters in CPUID leaf 4 on Intel or
+	// 0x8000001D on AMD, falling back to the legacy L2/L3 descriptors in 0x80000006. Returns 0 if nothing is reported.
+	inline uint64_t lastLevelCacheBytes() {
+		uint32_t registers[4];
+		cpuid(0, 0, registers);
+		uint32_t maxLeaf = registers[0];
+		cpuid(0x80000000, 0, registers);
+		uint32_t maxExtendedLeaf = registers[0];
+
+		uint64_t largest = 0;
+		const uint32_t cacheLeaves[] = { 4, 0x8000001D };
+
+		for (auto leaf : cacheLeaves) {
+			if (leaf < 0x80000000 ? leaf > maxLeaf : leaf > maxExtendedLeaf) continue;
+
+			for (uint32_t subleaf = 0; subleaf < 16; subleaf++) {
+				cpuid(leaf, subleaf, registers);
+				uint32_t cacheType = registers[0] & 0x1F;
+				if (cacheType == 0) break; // No more caches
+				if (cacheType == 2) continue; // Instruction cache
+
+				uint64_t ways = ((registers[1] >> 22) & 0x3FF) + 1;
+				uint64_t partitions = ((registers[1] >> 12) & 0x3FF) + 1;
+				uint64_t lineSize = (registers[1] & 0xFFF) + 1;
+				uint64_t sets = (uint64_t)registers[2] + 1;
+				uint64_t size = ways * partitions * lineSize * sets;
+				if (size > largest) largest = size;
+			}
+
+			if (largest > 0) return largest;
+		}
+
+		if (maxExtendedLeaf >= 0x80000006) {
+			cpuid(0x80000006, 0, registers);
+			uint64_t l2 = (uint64_t)(registers[2] >> 16) * 1024;
+			uint64_t l3 = (uint64_t)(registers[3] >> 18) * 512 * 1024;
+			largest = l3 > l2 ? l3 : l2;
+		}
+
+		return largest;
+	}
+
+	// Hints that the cache line holding address will be needed soon.
+	inline void prefetch(const void *address) {
+		_mm_prefetch((const char*)address, _MM_HINT_T0);
+	}
+
+	inline uint32_t countBits(uint32_t bits) {
+		uint32_t count = 0;
+		for (; bits; bits &= bits - 1) count++;
+		return count;
+	}
+
+	// The index of the lowest set bit. bits must not be 0.
+	inline uint32_t lowestBitIndex(uint32_t bits) {
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, bits);
+		return (uint32_t)index;
+#else
+		return (uint32_t)__builtin_ctz(bits);
+#endif
+	}
+
+	// Software conversions between floats and IEEE half floats, rounding to nearest even like F16C does,
+	// so that every level stores bit-identical halves.
+	inline uint16_t floatToHalf(float value) {
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+
+		uint32_t sign = (bits >> 16) & 0x8000;
+		uint32_t exponent = (bits >> 23) & 0xFF;
+		uint32_t mantissa = bits & 0x7FFFFF;
+
+		if (exponent == 0xFF) return (uint16_t)(sign | 0x7C00 | (mantissa ? 0x200 | (mantissa >> 13) : 0)); // Infinity or quiet NaN
+
+		int halfExponent = (int)exponent - 127 + 15;
+		if (halfExponent >= 31) return (uint16_t)(sign | 0x7C00); // Too large, so infinity
+		if (halfExponent < -10) return (uint16_t)sign; // Too small even for a denormal, so zero
+
+		uint32_t shift = 13;
+		if (halfExponent <= 0) {
+			// Denormal: the implicit leading 1 becomes explicit and the mantissa is shifted down further
+			mantissa |= 0x800000;
+			shift = 14 - halfExponent;
+			halfExponent = 0;
+		}
+
+		uint32_t half = ((uint32_t)halfExponent << 10) | (mantissa >> shift);
+		uint32_t remainder = mantissa & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+
+		// A carry out of the mantissa correctly increments the exponent, up to infinity.
+		if (remainder > halfway || (remainder == halfway && (half & 1))) half++;
+
+		return (uint16_t)(sign | half);
+	}
+
+	inline float halfToFloat(uint16_t half) {
+		uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+		uint32_t exponent = (half >> 10) & 0x1F;
+		uint32_t mantissa = half & 0x3FF;
+		uint32_t bits;
+
+		if (exponent == 0x1F) bits = sign | 0x7F800000 | (mantissa ? 0x400000 | (mantissa << 13) : 0); // Infinity or quiet NaN
+		else if (exponent != 0) bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+		else if (mantissa == 0) bits = sign;
+		else {
+			// Denormal: normalise it, as every half denormal is a normal float
+			exponent = 113;
+			while (!(mantissa & 0x400)) {
+				mantissa <<= 1;
+				exponent--;
+			}
+			bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+		}
+
+		float result;
+		memcpy(&result, &bits, sizeof(result));
+		return result;
+	}
+
+	SIMD_TARGET_AVX2 inline void halvesToFloatsF16c(const uint16_t *halves, float *floats, uint32_t count) {
+		uint32_t i = 0;
+		for (; i + 8 <= count; i += 8) _mm256_storeu_ps(floats + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(halves + i))));
+		for (; i < count; i++) floats[i] = halfToFloat(halves[i]);
+	}
+
+	// Converts an array of halves, with F16C if the CPU has it.
+	inline void halvesToFloats(const uint16_t *halves, float *floats, uint32_t count) {
+		static const bool hasF16c = detectLevel() >= Level::avx2;
+
+		if (hasF16c) halvesToFloatsF16c(halves, floats, count);
+		else for (uint32_t i = 0; i < count; i++) floats[i] = halfToFloat(halves[i]);
+	}
+
+	// Each instruction set is wrapped in a struct with the same static interface, so that kernels
+	// can be written once as templates. Int holds one 32-bit integer per float lane, for hashing in RandomGenerator and the turbulence noise.
+	// firstLanes(n) is the mask of the first n lanes, for the partial vector at the end of a range.
+	// andNotMask(a, b) is the lanes of a that aren't in b. sum(a) adds up the lanes of a.
+	// asFloat(a) reinterprets the bits of a as floats.
+	// load and store need addresses aligned to the size of the vector, and loadUnaligned and storeUnaligned don't.
+	// loadHalf and storeHalf convert between floats in registers and half floats in memory, and need no alignment.
+
+	struct Scalar {
+		static const uint32_t width = 1;
+		typedef float Float;
+		typedef bool Mask;
+		typedef uint32_t Int;
+
+		static Float load(const float *ptr) { return *ptr; }
+		static void store(float *ptr, Float value) { *ptr = value; }
+		static Float loadUnaligned(const float *ptr) { return *ptr; }
+		static void storeUnaligned(float *ptr, Float value) { *ptr = value; }
+		static Float loadHalf(const uint16_t *ptr) { return halfToFloat(*ptr); }
+		static void storeHalf(uint16_t *ptr, Float value) { *ptr = floatToHalf(value); }
+		static Float set(float value) { return value; }
+		static Float add(Float a, Float b) { return a + b; }
+		static Float sub(Float a, Float b) { return a - b; }
+		static Float mul(Float a, Float b) { return a * b; }
+		static Float div(Float a, Float b) { return a / b; }
+		static Float mulAdd(Float a, Float b, Float c) { return a * b + c; }
+		static Float sqrt(Float a) { return sqrtf(a); }
+		static Float maximum(Float a, Float b) { return a > b ? a : b; }
+		static float sum(Float a) { return a; }
+		static Float floor(Float a) { return floorf(a); }
+		static Mask greaterThan(Float a, Float b) { return a > b; }
+		static Float blend(Float a, Float b, Mask useB) { return useB ? b : a; }
+		static uint32_t maskBits(Mask mask) { return mask ? 1 : 0; }
+		static Mask andMask(Mask a, Mask b) { return a && b; }
+		static Mask andNotMask(Mask a, Mask b) { return a && !b; }
+		static Mask orMask(Mask a, Mask b) { return a || b; }
+		static Mask firstLanes(uint32_t count) { return count > 0; }
+
+		static Int setInt(uint32_t value) { return value; }
+		static Int laneIndices(uint32_t first) { return first; }
+		static Int addInt(Int a, Int b) { return a + b; }
+		static Int mulInt(Int a, Int b) { return a * b; }
+		static Int xorInt(Int a, Int b) { return a ^ b; }
+		static Int andInt(Int a, Int b) { return a & b; }
+		template<int count> static Int shiftRight(Int a) { return a >> count; }
+		template<int count> static Int shiftLeft(Int a) { return a << count; }
+		static Int truncateToInt(Float a) { return (uint32_t)(int32_t)a; }
+		static Float asFloat(Int a) {
+			float result;
+			memcpy(&result, &a, sizeof(result));
+			return result;
+		}
+
+		// Random bits to floats in the range 0.0f-1.0f (exclusive of 1.0f), using the top 23 bits as the mantissa.
+		static Float unitFloats(Int bits) {
+			uint32_t floatBits = (bits >> 9) | 0x3F800000;
+			float result;
+			memcpy(&result, &floatBits, sizeof(result));
+			return result - 1.0f;
+		}
+
+		// As unitFloats, but in the range -1.0f-1.0f (exclusive of 1.0f).
+		static Float signedUnitFloats(Int bits) {
+			uint32_t floatBits = (bits >> 9) | 0x40000000;
+			float result;
+			memcpy(&result, &floatBits, sizeof(result));
+			return result - 3.0f;
+		}
+	};
+
+	struct Sse4 {
+		static const uint32_t width = 4;
+		typedef __m128 Float;
+		typedef __m128 Mask;
+		typedef __m128i Int;
+
+		SIMD_TARGET_SSE4 static Float load(const float *ptr) { return _mm_load_ps(ptr); }
+		SIMD_TARGET_SSE4 static void store(float *ptr, Float value) { _mm_store_ps(ptr, value); }
+		SIMD_TARGET_SSE4 static Float loadUnaligned(const float *ptr) { return _mm_loadu_ps(ptr); }
+		SIMD_TARGET_SSE4 static void storeUnaligned(float *ptr, Float value) { _mm_storeu_ps(ptr, value); }
+
+		// F16C isn't part of SSE4.1, so halves are converted in software one lane at a time.
+		SIMD_TARGET_SSE4 static Float loadHalf(const uint16_t *ptr) {
+			return _mm_setr_ps(halfToFloat(ptr[0]), halfToFloat(ptr[1]), halfToFloat(ptr[2]), halfToFloat(ptr[3]));
+		}
+		SIMD_TARGET_SSE4 static void storeHalf(uint16_t *ptr, Float value) {
+			alignas(16) float values[width];
+			_mm_store_ps(values, value);
+			for (uint32_t i = 0; i < width; i++) ptr[i] = floatToHalf(values[i]);
+		}
+
+		SIMD_TARGET_SSE4 static Float set(float value) { return _mm_set1_ps(value); }
+		SIMD_TARGET_SSE4 static Float add(Float a, Float b) { return _mm_add_ps(a, b); }
+		SIMD_TARGET_SSE4 static Float sub(Float a, Float b) { return _mm_sub_ps(a, b); }
+		SIMD_TARGET_SSE4 static Float mul(Float a, Float b) { return _mm_mul_ps(a, b); }
+		SIMD_TARGET_SSE4 static Float div(Float a, Float b) { return _mm_div_ps(a, b); }
+		SIMD_TARGET_SSE4 static Float mulAdd(Float a, Float b, Float c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+		SIMD_TARGET_SSE4 static Float sqrt(Float a) { return _mm_sqrt_ps(a); }
+		SIMD_TARGET_SSE4 static Float maximum(Float a, Float b) { return _mm_max_ps(a, b); }
+		SIMD_TARGET_SSE4 static float sum(Float a) {
+			__m128 pairs = _mm_add_ps(a, _mm_movehl_ps(a, a));
+			return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+		}
+		SIMD_TARGET_SSE4 static Float floor(Float a) { return _mm_floor_ps(a); }
+		SIMD_TARGET_SSE4 static Mask greaterThan(Float a, Float b) { return _mm_cmpgt_ps(a, b); }
+		SIMD_TARGET_SSE4 static Float blend(Float a, Float b, Mask useB) { return _mm_blendv_ps(a, b, useB); }
+		SIMD_TARGET_SSE4 static uint32_t maskBits(Mask mask) { return (uint32_t)_mm_movemask_ps(mask); }
+		SIMD_TARGET_SSE4 static Mask andMask(Mask a, Mask b) { return _mm_and_ps(a, b); }
+		SIMD_TARGET_SSE4 static Mask andNotMask(Mask a, Mask b) { return _mm_andnot_ps(b, a); }
+		SIMD_TARGET_SSE4 static Mask orMask(Mask a, Mask b) { return _mm_or_ps(a, b); }
+		SIMD_TARGET_SSE4 static Mask firstLanes(uint32_t count) { return _mm_cmplt_ps(_mm_setr_ps(0, 1, 2, 3), _mm_set1_ps((float)count)); }
+
+		SIMD_TARGET_SSE4 static Int setInt(uint32_t value) { return _mm_set1_epi32((int)value); }
+		SIMD_TARGET_SSE4 static Int laneIndices(uint32_t first) { return _mm_add_epi32(_mm_set1_epi32((int)first), _mm_setr_epi32(0, 1, 2, 3)); }
+		SIMD_TARGET_SSE4 static Int addInt(Int a, Int b) { return _mm_add_epi32(a, b); }
+		SIMD_TARGET_SSE4 static Int mulInt(Int a, Int b) { return _mm_mullo_epi32(a, b); }
+		SIMD_TARGET_SSE4 static Int xorInt(Int a, Int b) { return _mm_xor_si128(a, b); }
+		SIMD_TARGET_SSE4 static Int andInt(Int a, Int b) { return _mm_and_si128(a, b); }
+		template<int count> SIMD_TARGET_SSE4 static Int shiftRight(Int a) { return _mm_srli_epi32(a, count); }
+		template<int count> SIMD_TARGET_SSE4 static Int shiftLeft(Int a) { return _mm_slli_epi32(a, count); }
+		SIMD_TARGET_SSE4 static Int truncateToInt(Float a) { return _mm_cvttps_epi32(a); }
+		SIMD_TARGET_SSE4 static Float asFloat(Int a) { return _mm_castsi128_ps(a); }
+
+		SIMD_TARGET_SSE4 static Float unitFloats(Int bits) {
+			__m128i floatBits = _mm_or_si128(_mm_srli_epi32(bits, 9), _mm_set1_epi32(0x3F800000));
+			return _mm_sub_ps(_mm_castsi128_ps(floatBits), _mm_set1_ps(1.0f));
+		}
+
+		SIMD_TARGET_SSE4 static Float signedUnitFloats(Int bits) {
+			__m128i floatBits = _mm_or_si128(_mm_srli_epi32(bits, 9), _mm_set1_epi32(0x40000000));
+			return _mm_sub_ps(_mm_castsi128_ps(floatBits), _mm_set1_ps(3.0f));
+		}
+	};
+
+	struct Avx2 {
+		static const uint32_t width = 8;
+		typedef __m256 Float;
+		typedef __m256 Mask;
+		typedef __m256i Int;
+
+		SIMD_TARGET_AVX2 static Float load(const float *ptr) { return _mm256_load_ps(ptr); }
+		SIMD_TARGET_AVX2 static void store(float *ptr, Float value) { _mm256_store_ps(ptr, value); }
+		SIMD_TARGET_AVX2 static Float loadUnaligned(const float *ptr) { return _mm256_loadu_ps(ptr); }
+		SIMD_TARGET_AVX2 static void storeUnaligned(float *ptr, Float value) { _mm256_storeu_ps(ptr, value); }
+		SIMD_TARGET_AVX2 static Float loadHalf(const uint16_t *ptr) { return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)ptr)); }
+		SIMD_TARGET_AVX2 static void storeHalf(uint16_t *ptr, Float value) {
+			_mm_storeu_si128((__m128i*)ptr, _mm256_cvtps_ph(value, _MM_FROUND_TO_NEAREST_INT));
+		}
+		SIMD_TARGET_AVX2 static Float set(float value) { return _mm256_set1_ps(value); }
+		SIMD_TARGET_AVX2 static Float add(Float a, Float b) { return _mm256_add_ps(a, b); }
+		SIMD_TARGET_AVX2 static Float sub(Float a, Float b) { return _mm256_sub_ps(a, b); }
+		SIMD_TARGET_AVX2 static Float mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+		SIMD_TARGET_AVX2 static Float div(Float a, Float b) { return _mm256_div_ps(a, b); }
+		SIMD_TARGET_AVX2 static Float mulAdd(Float a, Float b, Float c) { return _mm256_fmadd_ps(a, b, c); }
+		SIMD_TARGET_AVX2 static Float sqrt(Float a) { return _mm256_sqrt_ps(a); }
+		SIMD_TARGET_AVX2 static Float maximum(Float a, Float b) { return _mm256_max_ps(a, b); }
+		SIMD_TARGET_AVX2 static float sum(Float a) {
+			__m128 halves = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+			__m128 pairs = _mm_add_ps(halves, _mm_movehl_ps(halves, halves));
+			return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+		}
+		SIMD_TARGET_AVX2 static Float floor(Float a) { return _mm256_floor_ps(a); }
+		SIMD_TARGET_AVX2 static Mask greaterThan(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+		SIMD_TARGET_AVX2 static Float blend(Float a, Float b, Mask useB) { return _mm256_blendv_ps(a, b, useB); }
+		SIMD_TARGET_AVX2 static uint32_t maskBits(Mask mask) { return (uint32_t)_mm256_movemask_ps(mask); }
+		SIMD_TARGET_AVX2 static Mask andMask(Mask a, Mask b) { return _mm256_and_ps(a, b); }
+		SIMD_TARGET_AVX2 static Mask andNotMask(Mask a, Mask b) { return _mm256_andnot_ps(b, a); }
+		SIMD_TARGET_AVX2 static Mask orMask(Mask a, Mask b) { return _mm256_or_ps(a, b); }
+		SIMD_TARGET_AVX2 static Mask firstLanes(uint32_t count) {
+			return _mm256_cmp_ps(_mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_ps((float)count), _CMP_LT_OQ);
+		}
+
+		SIMD_TARGET_AVX2 static Int setInt(uint32_t value) { return _mm256_set1_epi32((int)value); }
+		SIMD_TARGET_AVX2 static Int laneIndices(uint32_t first) {
+			return _mm256_add_epi32(_mm256_set1_epi32((int)first), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+		}
+		SIMD_TARGET_AVX2 static Int addInt(Int a, Int b) { return _mm256_add_epi32(a, b); }
+		SIMD_TARGET_AVX2 static Int mulInt(Int a, Int b) { return _mm256_mullo_epi32(a, b); }
+		SIMD_TARGET_AVX2 static Int xorInt(Int a, Int b) { return _mm256_xor_si256(a, b); }
+		SIMD_TARGET_AVX2 static Int andInt(Int a, Int b) { return _mm256_and_si256(a, b); }
+		template<int count> SIMD_TARGET_AVX2 static Int shiftRight(Int a) { return _mm256_srli_epi32(a, count); }
+		template<int count> SIMD_TARGET_AVX2 static Int shiftLeft(Int a) { return _mm256_slli_epi32(a, count); }
+		SIMD_TARGET_AVX2 static Int truncateToInt(Float a) { return _mm256_cvttps_epi32(a); }
+		SIMD_TARGET_AVX2 static Float asFloat(Int a) { return _mm256_castsi256_ps(a); }
+
+		SIMD_TARGET_AVX2 static Float unitFloats(Int bits) {
+			__m256i floatBits = _mm256_or_si256(_mm256_srli_epi32(bits, 9), _mm256_set1_epi32(0x3F800000));
+			return _mm256_sub_ps(_mm256_castsi256_ps(floatBits), _mm256_set1_ps(1.0f));
+		}
+
+		SIMD_TARGET_AVX2 static Float signedUnitFloats(Int bits) {
+			__m256i floatBits = _mm256_or_si256(_mm256_srli_epi32(bits, 9), _mm256_set1_epi32(0x40000000));
+			return _mm256_sub_ps(_mm256_castsi256_ps(floatBits), _mm256_set1_ps(3.0f));
+		}
+	};
+
+	struct Avx512 {
+		static const uint32_t width = 16;
+		typedef __m512 Float;
+		typedef __mmask16 Mask;
+		typedef __m512i Int;
+
+		SIMD_TARGET_AVX512 static Float load(const float *ptr) { return _mm512_load_ps(ptr); }
+		SIMD_TARGET_AVX512 static void store(float *ptr, Float value) { _mm512_store_ps(ptr, value); }
+		SIMD_TARGET_AVX512 static Float loadUnaligned(const float *ptr) { return _mm512_loadu_ps(ptr); }
+		SIMD_TARGET_AVX512 static void storeUnaligned(float *ptr, Float value) { _mm512_storeu_ps(ptr, value); }
+		SIMD_TARGET_AVX512 static Float loadHalf(const uint16_t *ptr) { return _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)ptr)); }
+		SIMD_TARGET_AVX512 static void storeHalf(uint16_t *ptr, Float value) {
+			_mm256_storeu_si256((__m256i*)ptr, _mm512_cvtps_ph(value, _MM_FROUND_TO_NEAREST_INT));
+		}
+		SIMD_TARGET_AVX512 static Float set(float value) { return _mm512_set1_ps(value); }
+		SIMD_TARGET_AVX512 static Float add(Float a, Float b) { return _mm512_add_ps(a, b); }
+		SIMD_TARGET_AVX512 static Float sub(Float a, Float b) { return _mm512_sub_ps(a, b); }
+		SIMD_TARGET_AVX512 static Float mul(Float a, Float b) { return _mm512_mul_ps(a, b); }
+		SIMD_TARGET_AVX512 static Float div(Float a, Float b) { return _mm512_div_ps(a, b); }
+		SIMD_TARGET_AVX512 static Float mulAdd(Float a, Float b, Float c) { return _mm512_fmadd_ps(a, b, c); }
+		SIMD_TARGET_AVX512 static Float sqrt(Float a) { return _mm512_sqrt_ps(a); }
+		SIMD_TARGET_AVX512 static Float maximum(Float a, Float b) { return _mm512_max_ps(a, b); }
+		SIMD_TARGET_AVX512 static float sum(Float a) { return _mm512_reduce_add_ps(a); }
+		SIMD_TARGET_AVX512 static Float floor(Float a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+		SIMD_TARGET_AVX512 static Mask greaterThan(Float a, Float b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+		SIMD_TARGET_AVX512 static Float blend(Float a, Float b, Mask useB) { return _mm512_mask_blend_ps(useB, a, b); }
+		SIMD_TARGET_AVX512 static uint32_t maskBits(Mask mask) { return (uint32_t)mask; }
+		SIMD_TARGET_AVX512 static Mask andMask(Mask a, Mask b) { return (Mask)(a & b); }
+		SIMD_TARGET_AVX512 static Mask andNotMask(Mask a, Mask b) { return (Mask)(a & ~b); }
+		SIMD_TARGET_AVX512 static Mask orMask(Mask a, Mask b) { return (Mask)(a | b); }
+		SIMD_TARGET_AVX512 static Mask firstLanes(uint32_t count) { return count >= width ? (Mask)0xFFFF : (Mask)((1u << count) - 1); }
+
+		SIMD_TARGET_AVX512 static Int setInt(uint32_t value) { return _mm512_set1_epi32((int)value); }
+		SIMD_TARGET_AVX512 static Int laneIndices(uint32_t first) {
+			return _mm512_add_epi32(_mm512_set1_epi32((int)first), _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+		}
+		SIMD_TARGET_AVX512 static Int addInt(Int a, Int b) { return _mm512_add_epi32(a, b); }
+		SIMD_TARGET_AVX512 static Int mulInt(Int a, Int b) { return _mm512_mullo_epi32(a, b); }
+		SIMD_TARGET_AVX512 static Int xorInt(Int a, Int b) { return _mm512_xor_si512(a, b); }
+		SIMD_TARGET_AVX512 static Int andInt(Int a, Int b) { return _mm512_and_si512(a, b); }
+		template<int count> SIMD_TARGET_AVX512 static Int shiftRight(Int a) { return _mm512_srli_epi32(a, count); }
+		template<int count> SIMD_TARGET_AVX512 static Int shiftLeft(Int a) { return _mm512_slli_epi32(a, count); }
+		SIMD_TARGET_AVX512 static Int truncateToInt(Float a) { return _mm512_cvttps_epi32(a); }
+		SIMD_TARGET_AVX512 static Float asFloat(Int a) { return _mm512_castsi512_ps(a); }
+
+		SIMD_TARGET_AVX512 static Float unitFloats(Int bits) {
+			__m512i floatBits = _mm512_or_si512(_mm512_srli_epi32(bits, 9), _mm512_set1_epi32(0x3F800000));
+			return _mm512_sub_ps(_mm512_castsi512_ps(floatBits), _mm512_set1_ps(1.0f));
+		}
+
+		SIMD_TARGET_AVX512 static Float signedUnitFloats(Int bits) {
+			__m512i floatBits = _mm512_or_si512(_mm512_srli_epi32(bits, 9), _mm512_set1_epi32(0x40000000));
+			return _mm512_sub_ps(_mm512_castsi512_ps(floatBits), _mm512_set1_ps(3.0f));
+		}
+	};
+}